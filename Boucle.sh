@@ -1,7 +1,30 @@
 #!/bin/bash
 
-for i in 1 2 4 8 16 32 64; do
-    for j in 1 2 3 4; do
-        sbatch --ntasks=${i} work2.slurm ${i} ${j}
+# Scaling sweep: one job of work.slurm per configuration, so that each run
+# gets its own one hour limit.
+# Usage: ./Boucle.sh [ranks] [refinement levels] [assembly] [threads]
+# Hybrid MPI+OpenMP: a list of threads per rank, e.g.
+#   ./Boucle.sh 2,4,8,16 3 full 1,2,4
+ranks=${1:-1,2,4,8,16,32,64}
+levels=${2:-1,2,3,4}
+assembly=${3:-full}
+threads=${4:-0}   # 0: --threads is not passed
+
+mkdir -p sortie_slurm_Heatsim
+for i in ${ranks//,/ }; do
+    for j in ${levels//,/ }; do
+        for t in ${threads//,/ }; do
+            cpus=$((t > 0 ? t : 1))
+            # 4 tasks per node, as in work.slurm
+            nodes=$(((i + 3) / 4))
+            # Memory per rank: each refinement multiplies the mesh by 8, from
+            # about 1000M at -rp 1 in total (8000M per rank at -rp 4 on 64
+            # ranks), with at least 2000M per rank
+            mem_per_rank=$((1000 * 8 ** (j - 1) / i))
+            mem_per_rank=$((mem_per_rank > 2000 ? mem_per_rank : 2000))
+            mem_per_cpu=$((mem_per_rank / cpus))
+            sbatch --ntasks=${i} --nodes=${nodes} --cpus-per-task=${cpus} \
+                --mem-per-cpu=${mem_per_cpu}M work.slurm ${i} ${j} ${assembly} ${t#0}
+        done
     done
 done
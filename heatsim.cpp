@@ -15,20 +15,429 @@
 //               discrete linear system. We also cover the explicit elimination
 //               of essential boundary conditions, static condensation, and the
 //               optional connection to the GLVis tool for visualization.
+//
+//               With -tf > 0, a time dependent nonlinear heat equation
+//               du/dt = \nabla \cdot (\kappa + \alpha u) \nabla u is
+//               integrated instead (based on ex16p), with the diffusion
+//               operator linearized with the lagged solution of the previous
+//               time step.
 
 #include "mfem.hpp"
+#include <algorithm>
 #include <fstream>
+#include <iomanip>
 #include <iostream>
 #include <chrono>
 #include <string>
+#include <cstring>
+#include <sstream>
+#include <thread>
+#include <vector>
+#include <csignal>
+#include <cstdint>
+#include <cstdio>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 using namespace std;
 using namespace mfem;
 
+// Peak resident set size of this rank, in megabytes (ru_maxrss is in KB on Linux).
+static double PeakMemoryMB() {
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  return usage.ru_maxrss / 1024.0;
+}
+
+// Size of a file in bytes, or 0 if it does not exist.
+static double FileSize(const std::string &path) {
+  struct stat info;
+  return stat(path.c_str(), &info) == 0 ? static_cast<double>(info.st_size) : 0.0;
+}
+
+// Applies the preconditioner once to a zero vector. Hypre solvers run their
+// setup on the first application, so this lets the setup be timed apart from
+// the solve.
+static void SetupPreconditioner(Solver &prec, int size) {
+  Vector zero(size), y(size);
+  zero = 0.0;
+  prec.Mult(zero, y);
+}
+
+// Same as HypreParMatrix::EliminateBC for a matrix A whose essential rows and
+// columns were eliminated into Ae: B -= Ae X, then B = diag(A) X on the
+// essential dofs. The essential dofs are set on the OpenMP threads.
+static void EliminateEssentialDofs(const HypreParMatrix &Ae, const Vector &A_diag,
+                                   const Array<int> &ess_tdof_list, const Vector &X,
+                                   Vector &B) {
+  Ae.Mult(-1.0, X, 1.0, B);
+  const int *ess = ess_tdof_list.GetData();
+  const double *diag = A_diag.GetData();
+  const double *x = X.GetData();
+  double *b = B.GetData();
+#ifdef _OPENMP
+#pragma omp parallel for
+#endif
+  for (int i = 0; i < ess_tdof_list.Size(); i++) {
+    b[ess[i]] = diag[ess[i]] * x[ess[i]];
+  }
+}
+
+/** Instrumentation of one run. Phases are timed on each rank with Start/Stop
+ *  and accumulate when entered several times. Write reduces each phase over
+ *  the ranks (min, avg, max of the time, max of the peak RSS at its end), so
+ *  that load imbalance shows up, and rank 0 appends the run as one row of
+ *  <prefix>.csv and one record of <prefix>.jsonl.
+ */
+class Benchmark {
+public:
+  /// How a value is combined over the ranks.
+  enum Reduction { SAME, SUM, MAX };
+
+  Benchmark();
+
+  void Start(const std::string &phase);
+  void Stop(const std::string &phase);
+  /// Add time to a phase, in seconds.
+  void AddTime(const std::string &phase, double seconds);
+  /// Time of a phase on this rank, in seconds.
+  double GetTime(const std::string &phase) const;
+
+  void SetLabel(const std::string &name, const std::string &value);
+  void SetValue(const std::string &name, double value, Reduction reduction = SAME);
+  /// Record one case of the batch mode (JSON record only).
+  void AddCase(const std::string &name, int iterations, double seconds);
+
+  /// Collective. Returns false on rank 0 if the files cannot be written.
+  bool Write(const std::string &prefix, MPI_Comm comm) const;
+
+protected:
+  struct Phase {
+    std::string name;
+    double time;
+    double peak_rss; // peak RSS at the last Stop, in MB
+    bool running;
+    std::chrono::steady_clock::time_point start;
+  };
+  struct Value {
+    std::string name;
+    double value;
+    Reduction reduction;
+  };
+  struct Case {
+    std::string name;
+    int iterations;
+    double time;
+  };
+
+  std::vector<Phase> phases;
+  std::vector<std::pair<std::string, std::string>> labels;
+  std::vector<Value> values;
+  std::vector<Case> cases;
+
+  Phase &GetPhase(const std::string &name);
+};
+
+/// Keeps a preconditioner from being reset when the Krylov solver that uses it
+/// changes operator, so that an AMG hierarchy can be reused over time steps.
+class ReusedPreconditioner : public Solver {
+protected:
+  Solver &prec;
+
+public:
+  ReusedPreconditioner(Solver &p) : Solver(p.Height(), p.Width()), prec(p) {}
+
+  virtual void SetOperator(const Operator &op) {
+    height = op.Height();
+    width = op.Width();
+  }
+  virtual void Mult(const Vector &x, Vector &y) const { prec.Mult(x, y); }
+};
+
+/// Krylov solver and BoomerAMG parameters of the linear solves. The AMG
+/// defaults are the ones of HypreBoomerAMG.
+struct SolverOptions {
+  enum Krylov { CG, PIPELINED_CG };
+
+  Krylov krylov = CG;
+  double rel_tol = 1e-12;
+  double abs_tol = 0.0;
+  int max_iter = 2000;
+  int print_level = 1;        // 0: none, 1: summary, 2: every iteration
+  int amg_coarsening = 10;    // hypre coarsening: 6 Falgout, 8 PMIS, 10 HMIS
+  int amg_interpolation = 6;  // hypre interpolation: 0 classical, 6 extended+i
+  int amg_aggressive = 1;     // levels of aggressive coarsening
+  int amg_smoother = 8;       // hypre relaxation: 8 l1-Gauss-Seidel, 18 l1-Jacobi, 16 Chebyshev
+  double amg_theta = 0.25;    // strength threshold
+  bool amg_reuse = false;     // batch: keep the first hierarchy for all the matrices
+  double reuse_tol = 0.1;     // transient: diffusivity change before the hierarchy is rebuilt
+};
+
+/** Pipelined preconditioned conjugate gradient (Ghysels and Vanroose, 2014).
+ *  The two dot products of an iteration are combined in a single
+ *  non-blocking reduction, which overlaps with the application of the
+ *  preconditioner and of the operator, instead of two blocking reductions
+ *  in CG. The residual is updated by recurrences, so very tight tolerances
+ *  can take a few more iterations than CG.
+ */
+class PipelinedCGSolver : public IterativeSolver {
+protected:
+  MPI_Comm dot_comm;
+  mutable Vector r, u, w, m, n, p, q, s, z;
+
+  void Precondition(const Vector &x, Vector &y) const;
+
+public:
+  PipelinedCGSolver(MPI_Comm comm_) : IterativeSolver(comm_), dot_comm(comm_) {}
+
+  virtual void Mult(const Vector &b, Vector &x) const;
+};
+
+/** After spatial discretization, the conduction model can be written as:
+ *
+ *     du/dt = M^{-1}(-Ku)
+ *
+ *  where u is the vector representing the temperature, M is the mass matrix,
+ *  and K is the diffusion operator with diffusivity depending on u:
+ *  (\kappa + \alpha u).
+ *
+ *  Class ConductionOperator represents the right-hand side of the above ODE.
+ *  M is assembled once. The local matrix of K keeps its sparsity pattern and
+ *  is refilled in place when u changes; its parallel matrix is assembled
+ *  again, and T = M + dt K is their sum, without another triple product.
+ *  The AMG hierarchy of T is rebuilt only when the diffusivity has drifted
+ *  by more than reuse_tol since the last setup.
+ */
+class ConductionOperator : public TimeDependentOperator {
+protected:
+  ParFiniteElementSpace &fespace;
+  Array<int> ess_tdof_list; // this list remains empty for pure Neumann b.c.
+
+  ParBilinearForm *M;
+  ParBilinearForm *K;
+
+  HypreParMatrix *Mmat;
+  HypreParMatrix *Kmat;
+  HypreParMatrix *T;     // T = M + dt K
+  HypreParMatrix *T_amg; // matrix the AMG hierarchy was built from
+  double current_dt;
+
+  IterativeSolver *M_solver; // Krylov solver for inverting the mass matrix M
+  HypreSmoother M_prec;      // Preconditioner for the mass matrix M
+
+  IterativeSolver *T_solver;   // Implicit solver for T = M + dt K
+  HypreBoomerAMG T_amg_prec;   // AMG hierarchy for T
+  ReusedPreconditioner T_prec; // Preconditioner for the implicit solver
+
+  ParGridFunction u_alpha_gf;      // diffusivity kappa + alpha u
+  GridFunctionCoefficient u_coeff; // coefficient of K, refers to u_alpha_gf
+
+  double alpha, kappa, reuse_tol;
+  Vector u_param; // temperature of the last SetParameters
+  Vector u_amg;   // temperature of the last AMG setup
+  bool amg_stale;
+
+  int amg_setups;
+  double amg_setup_time;
+  int solver_iterations;
+
+  mutable Vector z; // auxiliary vector
+
+public:
+  ConductionOperator(ParFiniteElementSpace &f, double alpha, double kappa,
+                     const SolverOptions &solver, const Vector &u);
+
+  virtual void Mult(const Vector &u, Vector &du_dt) const;
+  /** Solve the Backward-Euler equation: k = f(u + dt*k, t), for the unknown k.
+      This is the only requirement for high-order SDIRK implicit integration.*/
+  virtual void ImplicitSolve(const double dt, const Vector &u, Vector &k);
+
+  /// Refill the diffusion BilinearForm K using the given true-dof vector `u`.
+  void SetParameters(const Vector &u);
+
+  /// Number of AMG setups done for T since construction.
+  int GetPreconditionerSetups() const { return amg_setups; }
+  /// Total time spent in these AMG setups, in seconds.
+  double GetPreconditionerSetupTime() const { return amg_setup_time; }
+  /// Total number of CG iterations of the implicit solves.
+  int GetSolverIterations() const { return solver_iterations; }
+
+  virtual ~ConductionOperator();
+};
+
+/// What the ResultWriter saves, and how.
+struct OutputOptions {
+  enum Region { VOLUME, BOUNDARY, NONE };
+
+  Region region = VOLUME;
+  bool solution = true;
+  bool partition = true;
+  int levels_of_detail = 1;
+  bool float32 = false;
+  int compression = 0; // zlib level, 0 for no compression
+};
+
+/** Saves the solution to a ParaView data collection. Either the whole volume
+ *  or only the boundary surface is saved, in which case the solution is
+ *  transferred to a boundary submesh first. The partition field is piecewise
+ *  constant, so it only stores one value per element.
+ *
+ *  SaveAsync writes on a dedicated I/O thread. The fields are not copied:
+ *  the solution and the mesh must not change until Wait returns, and the
+ *  caller must not start MPI collectives on the mesh communicator meanwhile.
+ */
+class ResultWriter {
+protected:
+  ParGridFunction &solution;
+
+  ParSubMesh *submesh;               // boundary surface, when only it is saved
+  FiniteElementCollection *sub_fec;
+  ParFiniteElementSpace *sub_fespace;
+  ParGridFunction *sub_solution;     // solution restricted to submesh
+  ParTransferMap *transfer;          // from solution to sub_solution
+
+  FiniteElementCollection *partition_fec;
+  ParFiniteElementSpace *partition_fespace;
+  ParGridFunction *partition;
+
+  ParaViewDataCollection *pd;
+  std::string collection_path;
+  int cycle;
+  std::thread io_thread;
+  double write_time;
+  double bytes_written;
+
+  void Write();
+
+public:
+  ResultWriter(const char *name, ParGridFunction &solution, const OutputOptions &options);
+
+  /// Save the current solution as the given cycle and wait for the write.
+  void Save(int cycle, double time);
+  /// Start saving the current solution on the I/O thread.
+  void SaveAsync(int cycle, double time);
+  /// Wait for the write started by SaveAsync, if any.
+  void Wait();
+
+  /// Total time spent writing files, in seconds.
+  double GetWriteTime() const { return write_time; }
+  /// Total size of the files written by this rank, in bytes.
+  double GetBytesWritten() const { return bytes_written; }
+
+  ~ResultWriter();
+};
+
+/** One steady-state problem of a case file. All values are indexed by
+ *  attribute - 1: the source by domain attribute, the boundary conditions by
+ *  boundary attribute. A boundary is either Dirichlet (dirichlet = 1, with
+ *  its temperature), or natural with a prescribed flux and an optional Robin
+ *  transfer coefficient. The flux already includes the robin_h * T_inf term
+ *  of the Robin conditions.
+ */
+struct HeatCase {
+  std::string name;
+  Vector source;
+  Array<int> dirichlet;
+  Vector temperature;
+  Vector flux;
+  Vector robin_h;
+
+  /// Whether the two cases lead to the same matrix and essential dofs.
+  bool SharesMatrix(const HeatCase &other) const;
+};
+
+/** State of a run saved in a checkpoint, besides the mesh: the solution as
+ *  the local true dofs, and where the run stopped. The step is the last time
+ *  step in transient mode, the number of cases solved in batch mode and the
+ *  number of adaptive cycles in steady-state mode. The sequence numbers the
+ *  checkpoints written with the same prefix.
+ */
+struct CheckpointState {
+  enum Mode { STEADY, TRANSIENT, BATCH };
+
+  int mode = STEADY;
+  int order = 1;
+  int ref_levels = 0;
+  int step = 0;
+  int sequence = 0;
+  double time = 0.0;
+  Vector solution;
+};
+
+/** Writes checkpoints, one binary file per rank, every `interval` seconds of
+ *  wall time or when SLURM sends SIGTERM before the time limit. Due is
+ *  collective: the decision is reduced over the ranks, so that they all write
+ *  their piece of the same checkpoint. Successive checkpoints alternate
+ *  between two slots, so that the previous one stays complete on every rank
+ *  while the next one is written.
+ */
+class Checkpointer {
+protected:
+  std::string prefix;
+  double interval;
+  std::chrono::steady_clock::time_point last_write;
+  bool terminated;
+  int sequence;
+  int count;
+  double bytes_written;
+
+public:
+  /// An empty prefix disables the checkpoints (and the SIGTERM handler).
+  Checkpointer(const char *prefix, double interval);
+
+  bool Enabled() const { return !prefix.empty(); }
+  /// Number the next checkpoints after the one a restarted run was read from.
+  void ContinueFrom(int s) { sequence = s; }
+  /// Collective. Whether a checkpoint must be written now.
+  bool Due();
+  /// Collective. Write the mesh and the state, replacing the last checkpoint.
+  void Write(ParMesh &pmesh, const CheckpointState &state);
+  /// Whether SIGTERM was received: the run stops after the checkpoint.
+  bool Terminated() const { return terminated; }
+  /// Restore the default SIGTERM action, once no checkpoint can be written.
+  void ReleaseSigterm();
+
+  int GetCount() const { return count; }
+  /// Total size of the checkpoints written by this rank, in bytes.
+  double GetBytesWritten() const { return bytes_written; }
+};
+
+bool ReadCases(const char *filename, int num_attributes, int num_bdr_attributes,
+               std::vector<HeatCase> &cases);
+std::vector<int> GroupCasesByMatrix(const std::vector<HeatCase> &cases);
+bool ParseOutputFields(const char *fields, OutputOptions &options);
+std::string MeshIdentity(const char *mesh_file);
+ParMesh *LoadCachedMesh(const std::string &prefix, int ref_levels, const std::string &identity);
+void SaveCachedMesh(ParMesh &pmesh, const std::string &prefix, int ref_levels,
+                    const std::string &identity);
+ParMesh *ReadCheckpoint(const std::string &prefix, CheckpointState &state);
+ODESolver *CreateODESolver(int ode_solver_type);
+bool ReadSolverConfig(const char *filename, SolverOptions &options);
+bool ParseKrylov(const char *name, SolverOptions::Krylov &krylov);
+IterativeSolver *CreateKrylovSolver(MPI_Comm comm, const SolverOptions &options);
+void ConfigureAMG(HypreBoomerAMG &amg, const SolverOptions &options);
+double InitialTemperature(const Vector &x);
+
 int main(int argc, char *argv[]) {
 
- // 1. Initialize MPI and HYPRE.
-  auto start_program = std::chrono::steady_clock::now();
-  Mpi::Init();
+ // 1. Initialize MPI and HYPRE. MPI_THREAD_MULTIPLE, which can slow down all
+ //    the communications, is only requested for the I/O thread of
+ //    --async-output; otherwise only the main thread calls MPI.
+  Benchmark benchmark;
+  benchmark.Start("total");
+  bool async_requested = false;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "-async") == 0 || strcmp(argv[i], "--async-output") == 0) {
+      async_requested = true;
+    } else if (strcmp(argv[i], "-sync") == 0 || strcmp(argv[i], "--sync-output") == 0) {
+      async_requested = false;
+    }
+  }
+  int mpi_thread_support = MPI_THREAD_SINGLE;
+  Mpi::Init(argc, argv, async_requested ? MPI_THREAD_MULTIPLE : MPI_THREAD_FUNNELED,
+            &mpi_thread_support);
 //  int num_procs = Mpi::WorldSize();
   int myid = Mpi::WorldRank();
   Hypre::Init();
@@ -38,7 +447,56 @@ int main(int argc, char *argv[]) {
   int order = 1;
   int par_ref_levels = 1;
   const char *output = "Heatsim";
-  int processors = 1; //by default (Configure through SLURM)
+  const char *benchmark_file = "Heatsim_benchmark";
+  const char *assembly = "full";
+  int ode_solver_type = 3;
+  double t_final = 0.0; // steady-state solve by default
+  double dt = 1.0e-2;
+  double alpha = 1.0e-2;
+  double kappa = 0.5;
+  int vis_steps = 10;
+  const char *output_fields = "solution,partition";
+  const char *output_region = "volume";
+  int output_lod = -1; // order of the finite elements
+  bool output_float32 = false;
+  int output_compression = 0;
+  bool output_async = false;
+  const char *mesh_cache = "";
+  const char *case_file = "";
+  bool partition_only = false;
+  int threads = 1;
+  bool adaptive = false;
+  bool estimate = false;
+  double amr_error = 0.0;
+  int amr_max_dofs = 1000000;
+  double amr_fraction = 0.7;
+  const char *checkpoint_file = "";
+  double checkpoint_interval = 0.0;
+  const char *restart_file = "";
+
+  // The solver configuration file gives the defaults of the solver options,
+  // so it is read before the command line, which overrides it. The transient
+  // mode solves at every time step, so it defaults to a looser tolerance and
+  // no solver output.
+  SolverOptions solver_options;
+  const char *solver_config = "";
+  bool transient_requested = false;
+  for (int i = 1; i + 1 < argc; i++) {
+    if (strcmp(argv[i], "-sc") == 0 || strcmp(argv[i], "--solver-config") == 0) {
+      solver_config = argv[i + 1];
+    } else if (strcmp(argv[i], "-tf") == 0 || strcmp(argv[i], "--t-final") == 0) {
+      transient_requested = atof(argv[i + 1]) > 0.0;
+    }
+  }
+  if (transient_requested) {
+    solver_options.rel_tol = 1e-8;
+    solver_options.max_iter = 200;
+    solver_options.print_level = 0;
+  }
+  if (strlen(solver_config) > 0 && !ReadSolverConfig(solver_config, solver_options)) {
+    return 1;
+  }
+  const char *krylov = solver_options.krylov == SolverOptions::PIPELINED_CG ? "pipecg" : "cg";
 
   OptionsParser args(argc, argv);
   args.AddOption(&mesh_file, "-m", "--mesh", "Mesh file to use.");
@@ -48,7 +506,101 @@ int main(int argc, char *argv[]) {
   args.AddOption(&par_ref_levels, "-rp", "--refine-parallel",
                  "Number of times to refine the mesh uniformly in parallel.");
   args.AddOption(&output, "-n", "--name", "Output data collection name");
-  args.AddOption(&processors, "-p", "--processeurs", "Number of processors used for output");
+  args.AddOption(&benchmark_file, "-b", "--benchmark",
+                 "Prefix of the benchmark files: one CSV row is appended to <prefix>.csv and one"
+                 " JSON record to <prefix>.jsonl for every run.");
+  args.AddOption(&assembly, "-asm", "--assembly",
+                 "Assembly level of the diffusion operator: full, partial or element."
+                 " Partial and element are matrix-free and use AMG on a low-order-refined mesh.");
+  args.AddOption(&t_final, "-tf", "--t-final",
+                 "Final time of the transient nonlinear conduction problem; start time is 0."
+                 " A value of 0 solves the steady-state problem.");
+  args.AddOption(&dt, "-dt", "--time-step", "Time step.");
+  args.AddOption(&ode_solver_type, "-s", "--ode-solver",
+                 "ODE solver: 1 - Backward Euler, 2 - SDIRK2, 3 - SDIRK3,\n\t"
+                 "\t   11 - Forward Euler, 12 - RK2, 13 - RK3 SSP, 14 - RK4.");
+  args.AddOption(&alpha, "-a", "--alpha", "Alpha coefficient.");
+  args.AddOption(&kappa, "-k", "--kappa", "Kappa coefficient offset.");
+  args.AddOption(&solver_options.reuse_tol, "-rt", "--reuse-tol",
+                 "Relative change of the diffusivity kappa + alpha u above which the AMG"
+                 " hierarchy of the transient solver is rebuilt.");
+  args.AddOption(&vis_steps, "-vs", "--visualization-steps",
+                 "Visualize every n-th timestep.");
+  args.AddOption(&output_fields, "-of", "--output-fields",
+                 "Comma-separated list of the fields to save: solution, partition.");
+  args.AddOption(&output_region, "-or", "--output-region",
+                 "Part of the mesh to save: volume, boundary (surface only) or none.");
+  args.AddOption(&output_lod, "-ol", "--output-lod",
+                 "Levels of detail of the saved elements, or -1 for the element order."
+                 " A value of 1 only saves the element vertices.");
+  args.AddOption(&output_float32, "-f32", "--float32", "-f64", "--float64",
+                 "Save the fields in single or double precision.");
+  args.AddOption(&output_compression, "-oc", "--output-compression",
+                 "Compression level of the saved files, from 0 (none) to 9.");
+  args.AddOption(&output_async, "-async", "--async-output", "-sync", "--sync-output",
+                 "Write the final results on a dedicated I/O thread, overlapped with the"
+                 " teardown of the solver. Intermediate saves stay synchronous.");
+  args.AddOption(&mesh_cache, "-mc", "--mesh-cache",
+                 "Prefix of the per-rank mesh files. Each rank reads its own piece, refined"
+                 " if available, instead of the serial mesh, and missing pieces are written.");
+  args.AddOption(&partition_only, "-po", "--partition-only", "-no-po", "--no-partition-only",
+                 "Only partition and refine the mesh into the mesh cache, then exit.");
+  args.AddOption(&case_file, "-c", "--cases",
+                 "Case file listing the sources and boundary conditions of several steady-state"
+                 " problems, solved in one run with a shared mesh, operator and preconditioner.");
+  args.AddOption(&adaptive, "-amr", "--adaptive", "-no-amr", "--no-adaptive",
+                 "Refine adaptively, where the estimated error is largest, after the uniform"
+                 " refinements of --refine-parallel.");
+  args.AddOption(&amr_error, "-ae", "--amr-error",
+                 "Estimated error at which the adaptive refinement stops.");
+  args.AddOption(&amr_max_dofs, "-ad", "--amr-max-dofs",
+                 "Number of unknowns at which the adaptive refinement stops.");
+  args.AddOption(&amr_fraction, "-af", "--amr-fraction",
+                 "Elements whose estimated error exceeds this fraction of the total error,"
+                 " divided by the square root of the number of elements, are refined.");
+  args.AddOption(&estimate, "-est", "--estimate", "-no-est", "--no-estimate",
+                 "Estimate the error of the steady-state solution (always done by --adaptive).");
+  args.AddOption(&checkpoint_file, "-ckpt", "--checkpoint",
+                 "Prefix of the per-rank checkpoint files, written every --checkpoint-interval"
+                 " and on SIGTERM, after which the run stops.");
+  args.AddOption(&checkpoint_interval, "-ci", "--checkpoint-interval",
+                 "Wall time between two checkpoints, in seconds, or 0 to only write one on"
+                 " SIGTERM.");
+  args.AddOption(&restart_file, "-rs", "--restart",
+                 "Prefix of the checkpoint files to restart from, instead of loading and"
+                 " refining the mesh.");
+  args.AddOption(&threads, "-t", "--threads",
+                 "OpenMP threads per rank, for hybrid MPI+OpenMP runs with fewer ranks per node.");
+  args.AddOption(&solver_config, "-sc", "--solver-config",
+                 "Solver configuration file of 'option value' lines, with the long names of the"
+                 " solver options below. Command-line options override it.");
+  args.AddOption(&krylov, "-ksp", "--krylov",
+                 "Krylov solver: cg, or pipecg for the pipelined CG with one overlapped"
+                 " reduction per iteration.");
+  args.AddOption(&solver_options.rel_tol, "-rtol", "--rel-tol",
+                 "Relative tolerance of the linear solver.");
+  args.AddOption(&solver_options.abs_tol, "-atol", "--abs-tol",
+                 "Absolute tolerance of the linear solver.");
+  args.AddOption(&solver_options.max_iter, "-maxit", "--max-iter",
+                 "Maximum number of iterations of the linear solver.");
+  args.AddOption(&solver_options.print_level, "-pl", "--print-level",
+                 "Output of the linear solver: 0 - none, 1 - summary, 2 - every iteration.");
+  args.AddOption(&solver_options.amg_coarsening, "-amgc", "--amg-coarsening",
+                 "BoomerAMG coarsening type: 6 - Falgout, 8 - PMIS, 10 - HMIS.");
+  args.AddOption(&solver_options.amg_interpolation, "-amgi", "--amg-interpolation",
+                 "BoomerAMG interpolation type: 0 - classical, 6 - extended+i,"
+                 " 8 - standard.");
+  args.AddOption(&solver_options.amg_aggressive, "-amga", "--amg-aggressive",
+                 "Number of levels of aggressive coarsening of BoomerAMG.");
+  args.AddOption(&solver_options.amg_smoother, "-amgs", "--amg-smoother",
+                 "BoomerAMG relaxation type: 8 - l1-Gauss-Seidel, 18 - l1-Jacobi,"
+                 " 16 - Chebyshev.");
+  args.AddOption(&solver_options.amg_theta, "-amgt", "--amg-theta",
+                 "BoomerAMG strength threshold, usually 0.5 for 3D problems.");
+  args.AddOption(&solver_options.amg_reuse, "-amgr", "--amg-reuse", "-no-amgr",
+                 "--no-amg-reuse",
+                 "Keep the AMG hierarchy of the first matrix of a case file for the other"
+                 " matrices instead of rebuilding it.");
 
   args.Parse();
   if (!args.Good()) {
@@ -61,39 +613,262 @@ int main(int argc, char *argv[]) {
     args.PrintOptions(cout);
   }
 
+  // Hybrid mode: the OpenMP threads of each rank run the hypre AMG setup and
+  // solve and, with the omp device of MFEM, the vector operations of the
+  // Krylov solvers and the assembly kernels.
+  if (threads < 1) {
+    if (myid == 0) {
+      cerr << "The number of threads must be positive." << endl;
+    }
+    return 1;
+  }
+#ifdef _OPENMP
+  omp_set_num_threads(threads);
+#else
+  if (threads > 1) {
+    if (myid == 0) {
+      cerr << "heatsim was built without OpenMP, running with one thread per rank." << endl;
+    }
+    threads = 1;
+  }
+#endif
+#ifdef MFEM_USE_OPENMP
+  Device device(threads > 1 ? "omp" : "cpu");
+#endif
+  bool hybrid = threads > 1;
+
+  // 3. Select how the diffusion operator is assembled. In hybrid mode, the
+  //    full assembly runs the element kernels on the threads (AssemblyLevel::
+  //    FULL) instead of the serial element loop, for the same sparse matrix.
+  AssemblyLevel assembly_level;
+  if (strcmp(assembly, "full") == 0) {
+    assembly_level = hybrid ? AssemblyLevel::FULL : AssemblyLevel::LEGACY;
+  } else if (strcmp(assembly, "partial") == 0) {
+    assembly_level = AssemblyLevel::PARTIAL;
+  } else if (strcmp(assembly, "element") == 0) {
+    assembly_level = AssemblyLevel::ELEMENT;
+  } else {
+    if (myid == 0) {
+      cerr << "Unknown assembly level: " << assembly << endl;
+    }
+    return 1;
+  }
+  bool matrix_free =
+      assembly_level == AssemblyLevel::PARTIAL || assembly_level == AssemblyLevel::ELEMENT;
+
+  if (!ParseKrylov(krylov, solver_options.krylov)) {
+    if (myid == 0) {
+      cerr << "Unknown Krylov solver: " << krylov << endl;
+    }
+    return 1;
+  }
+
+  if (partition_only && (strlen(mesh_cache) == 0 || strlen(restart_file) > 0)) {
+    if (myid == 0) {
+      cerr << "--partition-only requires --mesh-cache, without --restart." << endl;
+    }
+    return 1;
+  }
+
+  // Select what is saved and how.
+  OutputOptions output_options;
+  output_options.levels_of_detail = output_lod < 0 ? max(order, 1) : output_lod;
+  output_options.float32 = output_float32;
+  output_options.compression = output_compression;
+  if (!ParseOutputFields(output_fields, output_options)) {
+    if (myid == 0) {
+      cerr << "Unknown output field in: " << output_fields << endl;
+    }
+    return 1;
+  }
+  if (strcmp(output_region, "volume") == 0) {
+    output_options.region = OutputOptions::VOLUME;
+  } else if (strcmp(output_region, "boundary") == 0) {
+    output_options.region = OutputOptions::BOUNDARY;
+  } else if (strcmp(output_region, "none") == 0) {
+    output_options.region = OutputOptions::NONE;
+  } else {
+    if (myid == 0) {
+      cerr << "Unknown output region: " << output_region << endl;
+    }
+    return 1;
+  }
+  // The I/O thread calls MPI while the main thread tears down the solver.
+  if (output_async && mpi_thread_support < MPI_THREAD_MULTIPLE) {
+    if (myid == 0) {
+      cerr << "MPI_THREAD_MULTIPLE is not available, results are saved synchronously."
+           << endl;
+    }
+    output_async = false;
+  }
+
+  // The batch mode reuses one assembled matrix for many right-hand sides.
+  bool batch = strlen(case_file) > 0;
+  if (batch && (matrix_free || t_final > 0.0)) {
+    if (myid == 0) {
+      cerr << "The case file requires a steady-state solve with full assembly." << endl;
+    }
+    return 1;
+  }
+
+  // The adaptive refinement rebuilds the space and the solver at each cycle
+  // of a single steady-state problem.
+  if (adaptive && (batch || t_final > 0.0 || matrix_free)) {
+    if (myid == 0) {
+      cerr << "The adaptive mode requires a steady-state solve with full assembly." << endl;
+    }
+    return 1;
+  }
+
+  // Select the time integrator of the transient mode. The conduction operator
+  // is assembled as sparse matrices, so it requires full assembly.
+  bool transient = t_final > 0.0;
+  ODESolver *ode_solver = NULL;
+  if (transient) {
+    if (matrix_free) {
+      if (myid == 0) {
+        cerr << "The transient mode requires full assembly." << endl;
+      }
+      return 1;
+    }
+    ode_solver = CreateODESolver(ode_solver_type);
+    if (!ode_solver) {
+      if (myid == 0) {
+        cout << "Unknown ODE solver type: " << ode_solver_type << '\n';
+      }
+      return 3;
+    }
+  }
+
+  const char *mode = transient ? "transient" : (batch ? "batch" : "steady");
+  int checkpoint_mode = transient ? CheckpointState::TRANSIENT
+                                  : (batch ? CheckpointState::BATCH : CheckpointState::STEADY);
+
+  // Restarting
+  // With --restart, each rank reads its piece of the refined mesh and the
+  // state of the run from the checkpoint, and the mesh is neither loaded nor
+  // refined below.
+  ParMesh *pmesh_ptr = NULL;
+  const char *mesh_source = "serial";
+  int cached_levels = 0;
+  bool restart = strlen(restart_file) > 0;
+  CheckpointState checkpoint;
+  if (restart) {
+    benchmark.Start("restart");
+    pmesh_ptr = ReadCheckpoint(restart_file, checkpoint);
+    benchmark.Stop("restart");
+    if (!pmesh_ptr) {
+      return 1;
+    }
+    if (checkpoint.mode != checkpoint_mode || checkpoint.order != order) {
+      if (myid == 0) {
+        cerr << "The checkpoint " << restart_file << " was written by another mode or order."
+             << endl;
+      }
+      delete pmesh_ptr;
+      return 1;
+    }
+    if (myid == 0) {
+      cout << "Restarted from " << restart_file << " in " << benchmark.GetTime("restart")
+           << " s" << endl;
+    }
+    mesh_source = "checkpoint";
+    par_ref_levels = cached_levels = checkpoint.ref_levels;
+  }
+  checkpoint.mode = checkpoint_mode;
+  checkpoint.order = order;
+  checkpoint.ref_levels = par_ref_levels;
+  Checkpointer checkpointer(checkpoint_file, checkpoint_interval);
+  checkpointer.ContinueFrom(checkpoint.sequence);
+  bool interrupted = false;
+
   // Loading and mesh refining
   // 4. Read the (serial) mesh from the given mesh file on all processors.  We
   //    can handle triangular, quadrilateral, tetrahedral, hexahedral, surface
   //    and volume meshes with the same code.
-  auto start_mesh = std::chrono::steady_clock::now();
-  Mesh mesh(mesh_file, 1, 1);
-  int dim = mesh.Dimension();
-  if (myid == 0) {
-    std::cout << "Number of Elements before refinement: " << mesh.GetNE()
-              << std::endl;
+  //    With a mesh cache, each rank instead reads its own piece of the
+  //    parallel mesh, already refined if this refinement level was cached.
+  //    The pieces are only used if they were written from the same mesh
+  //    file, and writing them is timed apart from the loading.
+  benchmark.Start("load");
+  bool use_cache = !restart && strlen(mesh_cache) > 0;
+  std::string mesh_identity = use_cache ? MeshIdentity(mesh_file) : "";
+  bool cache_partitioned = false;
+  if (use_cache) {
+    pmesh_ptr = LoadCachedMesh(mesh_cache, par_ref_levels, mesh_identity);
+    if (pmesh_ptr) {
+      mesh_source = "cache";
+      cached_levels = par_ref_levels;
+    } else if (par_ref_levels > 0) {
+      pmesh_ptr = LoadCachedMesh(mesh_cache, 0, mesh_identity);
+      if (pmesh_ptr) {
+        mesh_source = "partitioned";
+      }
+    }
   }
+  if (!pmesh_ptr) {
+    Mesh mesh(mesh_file, 1, 1);
+    if (myid == 0) {
+      std::cout << "Number of Elements before refinement: " << mesh.GetNE()
+                << std::endl;
+    }
 
-  // 6. Define a parallel mesh by a partitioning of the serial mesh. Refine
-  //    this mesh further in parallel to increase the resolution. Once the
-  //    parallel mesh is defined, the serial mesh can be deleted.
-  ParMesh pmesh(MPI_COMM_WORLD, mesh);
-  mesh.Clear();
-  for (int l = 0; l < par_ref_levels; l++) {
+    // 6. Define a parallel mesh by a partitioning of the serial mesh. Once
+    //    the parallel mesh is defined, the serial mesh can be deleted.
+    pmesh_ptr = new ParMesh(MPI_COMM_WORLD, mesh);
+    mesh.Clear();
+    cache_partitioned = use_cache;
+  }
+  ParMesh &pmesh = *pmesh_ptr;
+  int dim = pmesh.Dimension();
+  benchmark.Stop("load");
+  if (myid == 0 && !restart) {
+    std::cout << "Mesh loaded from " << mesh_source << " in " << benchmark.GetTime("load")
+              << " s" << std::endl;
+  }
+  if (cache_partitioned) {
+    benchmark.Start("cache");
+    SaveCachedMesh(pmesh, mesh_cache, 0, mesh_identity);
+    benchmark.Stop("cache");
+  }
+
+  //    Refine the parallel mesh further to increase the resolution, starting
+  //    from the cached level, and cache the result for the next runs.
+  benchmark.Start("refine");
+  for (int l = cached_levels; l < par_ref_levels; l++) {
     pmesh.UniformRefinement();
   }
+  benchmark.Stop("refine");
+  if (use_cache && cached_levels < par_ref_levels) {
+    benchmark.Start("cache");
+    SaveCachedMesh(pmesh, mesh_cache, par_ref_levels, mesh_identity);
+    benchmark.Stop("cache");
+  }
 
   if (myid == 0) {
     std::cout << "Number of Elements after refinement: " << pmesh.GetNE()
               << std::endl;
   }
-  auto end_mesh = std::chrono::steady_clock::now();
-  double duration_mesh = std::chrono::duration_cast<std::chrono::milliseconds>(end_mesh - start_mesh).count();
+  // The adaptive refinement is nonconforming (with hanging nodes), which
+  // also lets the mesh be rebalanced across the ranks.
+  if (adaptive) {
+    benchmark.Start("refine");
+    pmesh.EnsureNCMesh(true);
+    benchmark.Stop("refine");
+  }
+  if (partition_only) {
+    if (myid == 0) {
+      cout << "Mesh pieces written to " << mesh_cache << endl;
+    }
+    delete pmesh_ptr;
+    return 0;
+  }
 
   // Assembling
   // 7. Define a parallel finite element space on the parallel mesh. Here we
   //    use continuous Lagrange finite elements of the specified order. If
   //    order < 1, we instead use an isoparametric/isogeometric space.
-  auto start_assembly = std::chrono::steady_clock::now();
+  benchmark.Start("space");
   FiniteElementCollection *fec;
   bool delete_fec;
   if (order > 0) {
@@ -110,6 +885,7 @@ int main(int argc, char *argv[]) {
     delete_fec = true;
   }
   ParFiniteElementSpace fespace(&pmesh, fec);
+  int fe_order = fec->GetOrder(); // order is -1 for an isoparametric space
   HYPRE_BigInt size = fespace.GlobalTrueVSize();
   if (myid == 0) {
     cout << "Number of finite element unknowns: " << size << endl;
@@ -125,109 +901,1605 @@ int main(int argc, char *argv[]) {
     ess_bdr = 1;
     fespace.GetEssentialTrueDofs(ess_bdr, ess_tdof_list);
   }
-  auto end_assembly = std::chrono::steady_clock::now();
-  double duration_assembly = std::chrono::duration_cast<std::chrono::milliseconds>(end_assembly - start_assembly).count();
+  benchmark.Stop("space");
 
   // Render
-  // 9. Set up the parallel linear form b(.) which corresponds to the
-  //    right-hand side of the FEM linear system, which in this case is
-  //    (1,phi_i) where phi_i are the basis functions in fespace.
-  auto start_resolution = std::chrono::steady_clock::now();
-  ParLinearForm b(&fespace);
-  ConstantCoefficient one(1.0);
-  b.AddDomainIntegrator(new DomainLFIntegrator(one));
-  b.Assemble();
-
-  // 10. Define the solution vector x as a parallel finite element grid
-  //     function corresponding to fespace. Initialize x with initial guess of
-  //     zero, which satisfies the boundary conditions.
+  // 9. Define the solution vector x as a parallel finite element grid
+  //    function corresponding to fespace, and the writer that saves it.
+  //    Initialize x with initial guess of zero, which satisfies the boundary
+  //    conditions.
   ParGridFunction x(&fespace);
   x = 0.0;
+  if (restart) {
+    MFEM_VERIFY(checkpoint.solution.Size() == fespace.GetTrueVSize(),
+                "The checkpoint solution does not match the finite element space.");
+    x.SetFromTrueDofs(checkpoint.solution);
+  }
 
-  // 11. Set up the parallel bilinear form a(.,.) on the finite element space
-  //     corresponding to the Laplacian operator -Delta, by adding the
-  //     Diffusion domain integrator.
-  ParBilinearForm a(&fespace);
-  a.AddDomainIntegrator(new DiffusionIntegrator(one));
-  a.Assemble();
-
-  OperatorPtr A;
-  Vector B, X;
-  a.FormLinearSystem(ess_tdof_list, x, b, A, X, B);
-
-  // 13. Solve the linear system A X = B.
-  //     * With full assembly, use the BoomerAMG preconditioner from hypre.
-  //     * With partial assembly, use Jacobi smoothing, for now.
-  Solver *prec = new HypreBoomerAMG;
-
-  CGSolver cg(MPI_COMM_WORLD);
-  cg.SetRelTol(1e-12);
-  cg.SetMaxIter(2000);
-  cg.SetPrintLevel(1);
-  if (prec) {
-    cg.SetPreconditioner(*prec);
+  benchmark.Start("save");
+  ResultWriter *writer = new ResultWriter(output, x, output_options);
+  benchmark.Stop("save");
+
+  // With asynchronous output, the final write is started as soon as the
+  // solution is known, so that it overlaps with the teardown of the solver.
+  // The time steps and cases are saved synchronously: the ParaView save
+  // runs collectives on the mesh communicator, which the solves use too.
+  int final_cycle = 0;
+  double final_time = 0.0;
+
+  int cg_iterations = 0;
+  int time_steps = 0;
+  int amg_setups = 0;
+  int amr_cycles = 0;
+  double estimated_error = 0.0;
+  // GetGlobalNE is a collective: it is only called while no write runs on
+  // the I/O thread.
+  double elements = pmesh.GetGlobalNE();
+
+  // A steady-state solve has no intermediate state, so its refined mesh is
+  // checkpointed before the assembly: a restart then skips the loading and
+  // the refinements. A SIGTERM received until then stops the run here. Only
+  // the adaptive cycles can checkpoint later on, so the other runs get the
+  // default SIGTERM action back.
+  if (!transient && !batch && checkpointer.Enabled()) {
+    if (!restart) {
+      benchmark.Start("checkpoint");
+      x.GetTrueDofs(checkpoint.solution);
+      checkpointer.Write(pmesh, checkpoint);
+      benchmark.Stop("checkpoint");
+    }
+    checkpointer.Due();
+    interrupted = checkpointer.Terminated();
+    if (!adaptive) {
+      checkpointer.ReleaseSigterm();
+    }
   }
-  cg.SetOperator(*A);
-  cg.Mult(B, X);
-  delete prec;
+  if (transient) {
+    // 10. Integrate the nonlinear conduction problem du/dt = C(u) in time,
+    //     starting from the initial temperature. All boundaries are
+    //     considered natural. The operator keeps the sparsity pattern of K and
+    //     its AMG hierarchy from one step to the next. After a
+    //     restart, the integration continues from the saved step.
+    benchmark.Start("assemble");
+    if (!restart) {
+      FunctionCoefficient u_0(InitialTemperature);
+      x.ProjectCoefficient(u_0);
+    }
+    Vector u;
+    x.GetTrueDofs(u);
+
+    ConductionOperator oper(fespace, alpha, kappa, solver_options, u);
+    ode_solver->Init(oper);
+    double t = restart ? checkpoint.time : 0.0;
+    time_steps = checkpoint.step;
+    benchmark.Stop("assemble");
+
+    benchmark.Start("solve");
+    bool last_step = false;
+    for (int ti = checkpoint.step + 1; !last_step; ti++) {
+      if (t + dt >= t_final - dt / 2) {
+        last_step = true;
+      }
+
+      ode_solver->Step(u, t, dt);
+      time_steps = ti;
+
+      // The last step is written by the save phase below.
+      if (!last_step && (ti % vis_steps) == 0) {
+        if (myid == 0) {
+          cout << "step " << ti << ", t = " << t << endl;
+        }
+
+        benchmark.Stop("solve");
+        benchmark.Start("save");
+        x.SetFromTrueDofs(u);
+        writer->Save(ti, t);
+        benchmark.Stop("save");
+        benchmark.Start("solve");
+      }
+      oper.SetParameters(u);
+
+      // The state after a step is complete, so the run can restart from it.
+      if (!last_step && checkpointer.Due()) {
+        benchmark.Stop("solve");
+        benchmark.Start("checkpoint");
+        checkpoint.step = ti;
+        checkpoint.time = t;
+        checkpoint.solution = u;
+        checkpointer.Write(pmesh, checkpoint);
+        benchmark.Stop("checkpoint");
+        benchmark.Start("solve");
+        if (checkpointer.Terminated()) {
+          interrupted = true;
+          break;
+        }
+      }
+    }
+    benchmark.Stop("solve");
+    // The AMG setups run inside the time steps: move their time from the
+    // solve phase to the setup phase.
+    benchmark.AddTime("solve", -oper.GetPreconditionerSetupTime());
+    benchmark.AddTime("amg_setup", oper.GetPreconditionerSetupTime());
+    x.SetFromTrueDofs(u);
+    if (output_async && !interrupted) {
+      writer->SaveAsync(time_steps, t);
+    } else {
+      final_cycle = time_steps;
+      final_time = t;
+    }
+    cg_iterations = oper.GetSolverIterations();
+    amg_setups = oper.GetPreconditionerSetups();
+    if (myid == 0) {
+      cout << "step " << time_steps << ", t = " << t << ", AMG setups: " << amg_setups
+           << endl;
+    }
+    delete ode_solver;
+  } else if (batch) {
+    // 10. Solve every case of the case file for -Delta u = f, with Dirichlet,
+    //     Neumann or Robin conditions on the boundary attributes. Cases with
+    //     the same Dirichlet boundaries and Robin coefficients share the
+    //     matrix and its AMG hierarchy, so they are solved one after the
+    //     other, each starting from the previous solution.
+    std::vector<HeatCase> cases;
+    int num_bdr_attributes = pmesh.bdr_attributes.Size() ? pmesh.bdr_attributes.Max() : 0;
+    if (!ReadCases(case_file, pmesh.attributes.Max(), num_bdr_attributes, cases)) {
+      return 1;
+    }
+    std::vector<int> case_order = GroupCasesByMatrix(cases);
+    if (checkpoint.step > static_cast<int>(case_order.size())) {
+      if (myid == 0) {
+        cerr << "The checkpoint " << restart_file << " was written with another case file."
+             << endl;
+      }
+      return 1;
+    }
+
+    ConstantCoefficient one(1.0);
+    PWConstCoefficient source, flux, robin_h, temperature;
+    ParLinearForm b(&fespace);
+    b.AddDomainIntegrator(new DomainLFIntegrator(source));
+    b.AddBoundaryIntegrator(new BoundaryLFIntegrator(flux));
+    b.UseFastAssembly(hybrid);
+
+    HypreParMatrix *A = NULL;
+    HypreParMatrix *Ae = NULL;    // eliminated Dirichlet columns of A
+    HypreParMatrix *A_amg = NULL; // matrix the AMG hierarchy was built from
+    HypreBoomerAMG *amg = NULL;
+    ReusedPreconditioner *amg_prec = NULL;
+    Array<int> case_ess_tdof_list;
+    const HeatCase *matrix_case = NULL;
+    Vector B, X;
+    Vector A_diag; // diagonal of A, imposed on the Dirichlet rows of B
+
+    IterativeSolver *solver = CreateKrylovSolver(MPI_COMM_WORLD, solver_options);
+    solver->iterative_mode = true; // start from the previous solution
 
-  // 14. Recover the parallel grid function corresponding to X. This is the
-  //     local finite element solution on each processor.
-  a.RecoverFEMSolution(X, b, x);
-  auto end_resolution = std::chrono::steady_clock::now();
-  double duration_resolution = std::chrono::duration_cast<std::chrono::milliseconds>(end_resolution - start_resolution).count();
+    // After a restart, x holds the solution of the last case solved, and the
+    // cases already solved are skipped.
+    for (size_t i = checkpoint.step; i < case_order.size(); i++) {
+      HeatCase &c = cases[case_order[i]];
+      if (!matrix_case || !c.SharesMatrix(*matrix_case)) {
+        // With --amg-reuse, the first hierarchy (and its matrix) is kept as
+        // the preconditioner of the following matrices.
+        benchmark.Start("assemble");
+        bool new_amg = !amg || !solver_options.amg_reuse;
+        delete Ae;
+        if (A != A_amg) {
+          delete A;
+        }
+        if (new_amg) {
+          delete amg_prec;
+          delete amg;
+          delete A_amg;
+        }
+        robin_h.UpdateConstants(c.robin_h);
+        ParBilinearForm a(&fespace);
+        a.AddDomainIntegrator(new DiffusionIntegrator(one));
+        a.AddBoundaryIntegrator(new BoundaryMassIntegrator(robin_h));
+        a.Assemble();
+        a.Finalize();
+        A = a.ParallelAssemble();
+        fespace.GetEssentialTrueDofs(c.dirichlet, case_ess_tdof_list);
+        Ae = A->EliminateRowsCols(case_ess_tdof_list);
+        A->GetDiag(A_diag);
+        if (new_amg) {
+          amg = new HypreBoomerAMG(*A);
+          ConfigureAMG(*amg, solver_options);
+          amg_prec = new ReusedPreconditioner(*amg);
+          A_amg = A;
+        }
+        solver->SetPreconditioner(*amg_prec);
+        solver->SetOperator(*A);
+        benchmark.Stop("assemble");
+
+        // The AMG setup is part of the shared cost rather than of the first case.
+        if (new_amg) {
+          benchmark.Start("amg_setup");
+          SetupPreconditioner(*amg, A->Height());
+          benchmark.Stop("amg_setup");
+          amg_setups++;
+        }
+        matrix_case = &c;
+      }
+
+      benchmark.Start("solve");
+      auto start_case = std::chrono::steady_clock::now();
+      source.UpdateConstants(c.source);
+      flux.UpdateConstants(c.flux);
+      b.Assemble();
+      b.ParallelAssemble(B);
+
+      // x keeps the previous solution, except on the Dirichlet boundaries.
+      temperature.UpdateConstants(c.temperature);
+      x.ProjectBdrCoefficient(temperature, c.dirichlet);
+      x.GetTrueDofs(X);
+      EliminateEssentialDofs(*Ae, A_diag, case_ess_tdof_list, X, B);
+
+      solver->Mult(B, X);
+      x.SetFromTrueDofs(X);
+      auto end_case = std::chrono::steady_clock::now();
+      benchmark.Stop("solve");
+
+      double case_time = std::chrono::duration<double>(end_case - start_case).count();
+      benchmark.AddCase(c.name, solver->GetNumIterations(), case_time);
+      cg_iterations += solver->GetNumIterations();
+      if (myid == 0) {
+        cout << "case " << c.name << ": " << solver->GetNumIterations() << " CG iterations, "
+             << case_time << " s" << endl;
+      }
+
+      // Each case is saved as the cycle of its position in the case file. The
+      // last one is written by the save phase below.
+      if (i + 1 < case_order.size()) {
+        benchmark.Start("save");
+        writer->Save(case_order[i], case_order[i]);
+        benchmark.Stop("save");
+      } else if (output_async) {
+        writer->SaveAsync(case_order[i], case_order[i]);
+      } else {
+        final_cycle = case_order[i];
+        final_time = case_order[i];
+      }
+
+      if (i + 1 < case_order.size() && checkpointer.Due()) {
+        benchmark.Start("checkpoint");
+        checkpoint.step = i + 1;
+        x.GetTrueDofs(checkpoint.solution);
+        checkpointer.Write(pmesh, checkpoint);
+        benchmark.Stop("checkpoint");
+        if (checkpointer.Terminated()) {
+          interrupted = true;
+          break;
+        }
+      }
+    }
+    delete solver;
+    delete amg_prec;
+    delete amg;
+    delete Ae;
+    if (A != A_amg) {
+      delete A;
+    }
+    delete A_amg;
+  } else if (!interrupted) {
+    // 10. Set up the parallel linear form b(.) which corresponds to the
+    //     right-hand side of the FEM linear system, which in this case is
+    //     (1,phi_i) where phi_i are the basis functions in fespace.
+    benchmark.Start("assemble");
+    ParLinearForm b(&fespace);
+    ConstantCoefficient one(1.0);
+    b.AddDomainIntegrator(new DomainLFIntegrator(one));
+    b.UseFastAssembly(hybrid); // element kernels on the threads
+
+    // 11. Set up the parallel bilinear form a(.,.) on the finite element space
+    //     corresponding to the Laplacian operator -Delta, by adding the
+    //     Diffusion domain integrator. With partial or element assembly, no
+    //     global matrix is built: A only applies the operator element by element.
+    ParBilinearForm a(&fespace);
+    a.SetAssemblyLevel(assembly_level);
+    a.AddDomainIntegrator(new DiffusionIntegrator(one));
+
+    // 12. The Kelly estimator measures the error of the solution from the
+    //     jumps of its flux across the element faces. In adaptive mode, the
+    //     refiner marks the elements that hold the largest errors, up to the
+    //     given fraction of the total error.
+    //     The flux is a vector L2 field of the order of the solution, so the
+    //     estimator is only built with --estimate or --adaptive.
+    DiffusionIntegrator flux_integrator(one);
+    L2_FECollection *flux_fec = NULL;
+    ParFiniteElementSpace *flux_fespace = NULL;
+    KellyErrorEstimator *estimator = NULL;
+    ThresholdRefiner *refiner = NULL;
+    if (estimate || adaptive) {
+      flux_fec = new L2_FECollection(fe_order, dim);
+      flux_fespace = new ParFiniteElementSpace(&pmesh, flux_fec, pmesh.SpaceDimension());
+      estimator = new KellyErrorEstimator(flux_integrator, x, *flux_fespace);
+    }
+    if (adaptive) {
+      refiner = new ThresholdRefiner(*estimator);
+      // The total error is the l2 norm of the element errors, as returned by
+      // the estimator, so that the refiner and the loop stop on the same value.
+      refiner->SetTotalErrorNormP(2.0);
+      refiner->SetTotalErrorFraction(amr_fraction);
+      refiner->SetTotalErrorGoal(amr_error);
+    }
+    benchmark.Stop("assemble");
+
+    // After a restart, the adaptive cycles continue from the saved mesh and
+    // solution.
+    const int first_cycle = checkpoint.step;
+    amr_cycles = first_cycle;
+    IterativeSolver *solver = NULL;
+    Solver *prec = NULL;
+    for (int cycle = first_cycle;; cycle++) {
+      benchmark.Start("assemble");
+      b.Assemble();
+      a.Assemble();
+
+      // x is zero, or the solution of the previous cycle interpolated on the
+      // refined mesh, which is the initial guess of the solver.
+      OperatorPtr A;
+      Vector B, X;
+      a.FormLinearSystem(ess_tdof_list, x, b, A, X, B);
+
+      // 13. Solve the linear system A X = B.
+      //     * With full assembly, use the BoomerAMG preconditioner from hypre.
+      //     * With partial or element assembly, use BoomerAMG on the low-order
+      //       refined (LOR) discretization, which is spectrally equivalent to the
+      //       high-order operator and only stores a first-order sparse matrix.
+      //     The Krylov solver is CG or the pipelined CG (--krylov).
+      if (matrix_free) {
+        LORSolver<HypreBoomerAMG> *lor = new LORSolver<HypreBoomerAMG>(a, ess_tdof_list);
+        ConfigureAMG(lor->GetSolver(), solver_options);
+        prec = lor;
+      } else {
+        HypreBoomerAMG *amg = new HypreBoomerAMG;
+        ConfigureAMG(*amg, solver_options);
+        prec = amg;
+      }
+      amg_setups++;
+
+      solver = CreateKrylovSolver(MPI_COMM_WORLD, solver_options);
+      solver->iterative_mode = true;
+      // SetOperator passes the operator on to the preconditioner, which is
+      // how BoomerAMG gets its matrix. The LOR solver already has its own
+      // sparse matrix and must not receive the matrix-free operator, so it is
+      // only attached afterwards.
+      if (matrix_free) {
+        solver->SetOperator(*A);
+        solver->SetPreconditioner(*prec);
+      } else {
+        solver->SetPreconditioner(*prec);
+        solver->SetOperator(*A);
+      }
+      benchmark.Stop("assemble");
+
+      benchmark.Start("amg_setup");
+      SetupPreconditioner(*prec, A->Height());
+      benchmark.Stop("amg_setup");
+
+      benchmark.Start("solve");
+      solver->Mult(B, X);
+      benchmark.Stop("solve");
+      cg_iterations += solver->GetNumIterations();
+
+      // 14. Recover the parallel grid function corresponding to X. This is the
+      //     local finite element solution on each processor.
+      a.RecoverFEMSolution(X, b, x);
+
+      if (estimator) {
+        benchmark.Start("estimate");
+        estimator->GetLocalErrors();
+        estimated_error = estimator->GetTotalError();
+        benchmark.Stop("estimate");
+      }
+      if (myid == 0 && adaptive) {
+        cout << "AMR cycle " << cycle << ": " << size << " unknowns, " << elements
+             << " elements, estimated error " << estimated_error << endl;
+      }
+
+      // 15. Stop at the error target or the DoF budget, or refine the marked
+      //     elements. The nonconforming mesh is then rebalanced across the
+      //     ranks, and x is interpolated (and redistributed) to the new mesh.
+      //     The solver of the last cycle is kept until the final write has
+      //     started.
+      if (!adaptive || size >= amr_max_dofs || estimated_error <= amr_error) {
+        break;
+      }
+      delete solver;
+      delete prec;
+      solver = NULL;
+      prec = NULL;
+      benchmark.Start("refine");
+      refiner->Apply(pmesh);
+      if (refiner->Stop()) {
+        benchmark.Stop("refine");
+        break;
+      }
+      fespace.Update();
+      x.Update();
+      pmesh.Rebalance();
+      fespace.Update();
+      x.Update();
+      a.Update();
+      b.Update();
+      if (pmesh.bdr_attributes.Size()) {
+        Array<int> ess_bdr(pmesh.bdr_attributes.Max());
+        ess_bdr = 1;
+        fespace.GetEssentialTrueDofs(ess_bdr, ess_tdof_list);
+      }
+      size = fespace.GlobalTrueVSize();
+      elements = pmesh.GetGlobalNE();
+      amr_cycles = cycle + 1;
+      benchmark.Stop("refine");
+
+      if (checkpointer.Due()) {
+        benchmark.Start("checkpoint");
+        checkpoint.step = amr_cycles;
+        x.GetTrueDofs(checkpoint.solution);
+        checkpointer.Write(pmesh, checkpoint);
+        benchmark.Stop("checkpoint");
+        if (checkpointer.Terminated()) {
+          interrupted = true;
+          break;
+        }
+      }
+    }
+
+    // The writer was built on the initial mesh, so it is rebuilt on the
+    // adapted one.
+    if (amr_cycles > first_cycle) {
+      benchmark.Start("save");
+      delete writer;
+      writer = new ResultWriter(output, x, output_options);
+      benchmark.Stop("save");
+    }
+    // The final write starts before the solver, its preconditioner, the
+    // estimator and the forms are freed, so that it overlaps their teardown.
+    // None of these destructors communicates.
+    if (output_async && !interrupted) {
+      writer->SaveAsync(0, 0.0);
+    }
+    delete solver;
+    delete prec;
+    delete refiner;
+    delete estimator;
+    delete flux_fespace;
+    delete flux_fec;
+  }
+  checkpointer.ReleaseSigterm();
+  double cg_iteration_time = cg_iterations > 0 ? benchmark.GetTime("solve") / cg_iterations : 0.0;
 
   // Saving results
-  // 15. Save the refined mesh and the solution in parallel.
-  auto start_save = std::chrono::steady_clock::now();
-  {
-    ParGridFunction partition(&fespace);
-    partition = static_cast<double>(myid);
-
-    ParaViewDataCollection *pd = NULL;
-    pd = new ParaViewDataCollection(output, &pmesh);
-    pd->SetPrefixPath("ParaView");
-    pd->RegisterField("solution", &x);
-    pd->RegisterField("partition", &partition);
-    pd->SetLevelsOfDetail(order);
-    pd->SetDataFormat(VTKFormat::BINARY);
-    pd->SetHighOrderOutput(true);
-    pd->SetCycle(0);
-    pd->SetTime(0.0);
-    pd->Save();
-    delete pd;
-  }
-  auto end_save = std::chrono::steady_clock::now();
-  double duration_save = std::chrono::duration_cast<std::chrono::milliseconds>(end_save - start_save).count();
+  // 15. Save the refined mesh and the solution in parallel. With
+  //     asynchronous output, only wait for the I/O thread to finish.
+  benchmark.Start("save");
+  if (output_async) {
+    writer->Wait();
+  } else if (!interrupted) {
+    writer->Save(final_cycle, final_time);
+  }
+  benchmark.AddTime("write", writer->GetWriteTime());
+  double bytes_written = writer->GetBytesWritten();
+  delete writer;
+  benchmark.Stop("save");
 
   // 17. Free the used memory.
   if (delete_fec) {
     delete fec;
   }
+  delete pmesh_ptr;
 
-  auto end_program = std::chrono::steady_clock::now();
-  double program_duration = std::chrono::duration_cast<std::chrono::milliseconds>(end_program - start_program).count();
-  double dofs_per_second = size / (program_duration / 1000.0);
-
-  //Saving Benchmark
-  std::string output_name = "Heatsim_ p_"+ std::to_string(processors)+"rp_"+std::to_string(par_ref_levels);
-  std::ofstream outputFile(output_name + "_timeMeasurement.csv");
-  if (outputFile.is_open()) {
-        outputFile << "nombre de processeurs / number of processors :  " << processors << std::endl;
-        outputFile << "nombre de raffinement parrallel / number of parrallel refinement :" << par_ref_levels << std::endl;
-        outputFile << "Resultats / Results : " <<  std::endl;
-        outputFile << "Raffinement / Refinement : " << duration_mesh << "milliseconds." << std::endl;
-        outputFile << "Assemblage / Assembling : " << duration_assembly << "milliseconds." << std::endl;
-        outputFile << "Résolution / Render : " << duration_resolution << "milliseconds." << std::endl;
-        outputFile << "Sauvegarde / Save : " << duration_save << "milliseconds." << std::endl;
-        outputFile << "Degrees of Freedom : " << size << std::endl;
-        outputFile << "Duree du programme / Program length : " << program_duration << " milliseconds" << endl;
-        outputFile << "DoF/s: " << dofs_per_second << endl;
-        outputFile.close();
-  } else {
-      std::cerr << "Impossible d'ouvrir le fichier CPU_timeMeasurement.csv pour écriture./ Unable to read CPU_timeMeasurment.csv" << std::endl;
-      return -1;
+  benchmark.Stop("total");
+
+  // Saving Benchmark
+  // 18. Record the configuration and the counters of the run, then append it
+  //     to the benchmark files with the phases reduced over all ranks.
+  benchmark.SetLabel("name", output);
+  benchmark.SetLabel("mode", mode);
+  benchmark.SetLabel("status", interrupted ? "interrupted" : "complete");
+  benchmark.SetLabel("mesh", mesh_file);
+  benchmark.SetLabel("mesh_source", mesh_source);
+  benchmark.SetLabel("assembly", assembly);
+  benchmark.SetLabel("refinement", adaptive ? "adaptive" : "uniform");
+  benchmark.SetLabel("krylov", krylov);
+  std::ostringstream amg_label;
+  amg_label << "c" << solver_options.amg_coarsening << "-i" << solver_options.amg_interpolation
+            << "-a" << solver_options.amg_aggressive << "-s" << solver_options.amg_smoother
+            << "-t" << solver_options.amg_theta << (solver_options.amg_reuse ? "-reuse" : "");
+  benchmark.SetLabel("amg", amg_label.str());
+  benchmark.SetValue("ranks", Mpi::WorldSize());
+  benchmark.SetValue("threads", threads);
+  benchmark.SetValue("order", order);
+  benchmark.SetValue("refine_levels", par_ref_levels);
+  benchmark.SetValue("dofs", size);
+  benchmark.SetValue("elements", elements);
+  benchmark.SetValue("rel_tol", solver_options.rel_tol);
+  benchmark.SetValue("cg_iterations", cg_iterations);
+  benchmark.SetValue("cg_iteration_time", cg_iteration_time, Benchmark::MAX);
+  benchmark.SetValue("amg_setups", amg_setups);
+  benchmark.SetValue("time_steps", time_steps);
+  benchmark.SetValue("bytes_written", bytes_written, Benchmark::SUM);
+  // The checkpoint bandwidth is the size of all the pieces over the time of
+  // the slowest rank.
+  double checkpoint_bytes = checkpointer.GetBytesWritten();
+  double checkpoint_time = benchmark.GetTime("checkpoint");
+  double total_checkpoint_bytes = 0.0;
+  double max_checkpoint_time = 0.0;
+  MPI_Allreduce(&checkpoint_bytes, &total_checkpoint_bytes, 1, MPI_DOUBLE, MPI_SUM,
+                MPI_COMM_WORLD);
+  MPI_Allreduce(&checkpoint_time, &max_checkpoint_time, 1, MPI_DOUBLE, MPI_MAX, MPI_COMM_WORLD);
+  benchmark.SetValue("checkpoints", checkpointer.GetCount());
+  benchmark.SetValue("checkpoint_bytes", checkpoint_bytes, Benchmark::SUM);
+  benchmark.SetValue("checkpoint_bandwidth",
+                     max_checkpoint_time > 0.0
+                         ? total_checkpoint_bytes / max_checkpoint_time / (1024.0 * 1024.0)
+                         : 0.0);
+  // Accuracy per DoF: the estimated error decreases as dofs^(-order/dim) at
+  // best, so this constant is lower when the DoFs are better placed.
+  benchmark.SetValue("amr_cycles", amr_cycles);
+  benchmark.SetValue("estimated_error", estimated_error);
+  benchmark.SetValue("error_constant",
+                     estimated_error * std::pow(static_cast<double>(size),
+                                                static_cast<double>(fe_order) / dim));
+  if (!benchmark.Write(benchmark_file, MPI_COMM_WORLD)) {
+    if (myid == 0) {
+      std::cerr << "Unable to write the benchmark files " << benchmark_file << ".csv/.jsonl"
+                << std::endl;
+    }
+    return -1;
   }
 
+  // A run stopped by SIGTERM exits with 2, so that job scripts can tell it
+  // from a complete run and restart it.
+  if (interrupted) {
+    if (myid == 0) {
+      cout << "Stopped by SIGTERM after a checkpoint, continue with --restart "
+           << checkpoint_file << endl;
+    }
+    return 2;
+  }
   return 0;
 }
+
+Benchmark::Benchmark() {
+  // The phases are always reported in this order, so that every run has the
+  // same columns.
+  const char *names[] = {"load", "refine", "cache", "restart", "space", "assemble", "amg_setup",
+                         "solve", "estimate", "checkpoint", "save", "write", "total"};
+  for (const char *name : names) {
+    Phase phase;
+    phase.name = name;
+    phase.time = 0.0;
+    phase.peak_rss = 0.0;
+    phase.running = false;
+    phases.push_back(phase);
+  }
+}
+
+Benchmark::Phase &Benchmark::GetPhase(const std::string &name) {
+  for (Phase &phase : phases) {
+    if (phase.name == name) {
+      return phase;
+    }
+  }
+  MFEM_ABORT("Unknown benchmark phase " << name);
+  return phases[0];
+}
+
+void Benchmark::Start(const std::string &name) {
+  Phase &phase = GetPhase(name);
+  MFEM_VERIFY(!phase.running, "Benchmark phase " << name << " is already running.");
+  phase.running = true;
+  phase.start = std::chrono::steady_clock::now();
+}
+
+void Benchmark::Stop(const std::string &name) {
+  Phase &phase = GetPhase(name);
+  MFEM_VERIFY(phase.running, "Benchmark phase " << name << " is not running.");
+  phase.running = false;
+  phase.time += std::chrono::duration<double>(std::chrono::steady_clock::now() - phase.start).count();
+  phase.peak_rss = PeakMemoryMB();
+}
+
+void Benchmark::AddTime(const std::string &name, double seconds) {
+  GetPhase(name).time += seconds;
+}
+
+double Benchmark::GetTime(const std::string &name) const {
+  return const_cast<Benchmark *>(this)->GetPhase(name).time;
+}
+
+void Benchmark::SetLabel(const std::string &name, const std::string &value) {
+  labels.push_back(std::make_pair(name, value));
+}
+
+void Benchmark::SetValue(const std::string &name, double value, Reduction reduction) {
+  Value v;
+  v.name = name;
+  v.value = value;
+  v.reduction = reduction;
+  values.push_back(v);
+}
+
+void Benchmark::AddCase(const std::string &name, int iterations, double seconds) {
+  Case c;
+  c.name = name;
+  c.iterations = iterations;
+  c.time = seconds;
+  cases.push_back(c);
+}
+
+// Quotes a string as a JSON value.
+static std::string JsonString(const std::string &text) {
+  std::string quoted = "\"";
+  for (char c : text) {
+    if (c == '"' || c == '\\') {
+      quoted += '\\';
+    }
+    quoted += c;
+  }
+  return quoted + "\"";
+}
+
+// Quotes a string as a CSV field (quotes are doubled).
+static std::string CsvString(const std::string &text) {
+  std::string quoted = "\"";
+  for (char c : text) {
+    if (c == '"') {
+      quoted += '"';
+    }
+    quoted += c;
+  }
+  return quoted + "\"";
+}
+
+bool Benchmark::Write(const std::string &prefix, MPI_Comm comm) const {
+  int rank, num_ranks;
+  MPI_Comm_rank(comm, &rank);
+  MPI_Comm_size(comm, &num_ranks);
+
+  // Phase times, then the peak RSS of the rank at the end of the run.
+  const int num_phases = phases.size();
+  std::vector<double> local(num_phases + 1), min(num_phases + 1), max(num_phases + 1),
+      sum(num_phases + 1), local_rss(num_phases), max_rss(num_phases);
+  for (int i = 0; i < num_phases; i++) {
+    local[i] = phases[i].time;
+    local_rss[i] = phases[i].peak_rss;
+  }
+  local[num_phases] = PeakMemoryMB();
+  MPI_Reduce(local.data(), min.data(), num_phases + 1, MPI_DOUBLE, MPI_MIN, 0, comm);
+  MPI_Reduce(local.data(), max.data(), num_phases + 1, MPI_DOUBLE, MPI_MAX, 0, comm);
+  MPI_Reduce(local.data(), sum.data(), num_phases + 1, MPI_DOUBLE, MPI_SUM, 0, comm);
+  MPI_Reduce(local_rss.data(), max_rss.data(), num_phases, MPI_DOUBLE, MPI_MAX, 0, comm);
+  std::vector<double> rank_rss(num_ranks);
+  MPI_Gather(&local[num_phases], 1, MPI_DOUBLE, rank_rss.data(), 1, MPI_DOUBLE, 0, comm);
+
+  std::vector<double> reduced(values.size());
+  for (size_t i = 0; i < values.size(); i++) {
+    reduced[i] = values[i].value;
+    if (values[i].reduction != SAME) {
+      MPI_Op op = values[i].reduction == SUM ? MPI_SUM : MPI_MAX;
+      MPI_Reduce(&values[i].value, &reduced[i], 1, MPI_DOUBLE, op, 0, comm);
+    }
+  }
+  if (rank != 0) {
+    return true;
+  }
+
+  std::ostringstream header;
+  for (const auto &label : labels) {
+    header << label.first << ",";
+  }
+  for (const Value &value : values) {
+    header << value.name << ",";
+  }
+  for (const Phase &phase : phases) {
+    header << phase.name << "_min," << phase.name << "_avg," << phase.name << "_max,"
+           << phase.name << "_rss_max,";
+  }
+  header << "peak_rss_min,peak_rss_avg,peak_rss_max";
+
+  // The header is written again when the columns differ from the ones of the
+  // last rows of the file, e.g. after an update of heatsim.
+  const std::string csv_name = prefix + ".csv";
+  const std::string first_column = header.str().substr(0, header.str().find(',') + 1);
+  std::string last_header;
+  std::ifstream existing(csv_name);
+  for (std::string line; std::getline(existing, line);) {
+    if (line.compare(0, first_column.size(), first_column) == 0) {
+      last_header = line;
+    }
+  }
+  existing.close();
+
+  std::ofstream csv(csv_name, std::ios::app);
+  std::ofstream json(prefix + ".jsonl", std::ios::app);
+  if (!csv || !json) {
+    return false;
+  }
+  csv.precision(10);
+  json.precision(10);
+
+  if (last_header != header.str()) {
+    csv << header.str() << std::endl;
+  }
+  for (const auto &label : labels) {
+    csv << CsvString(label.second) << ",";
+  }
+  for (size_t i = 0; i < values.size(); i++) {
+    csv << reduced[i] << ",";
+  }
+  for (int i = 0; i < num_phases; i++) {
+    csv << min[i] << "," << sum[i] / num_ranks << "," << max[i] << "," << max_rss[i] << ",";
+  }
+  csv << min[num_phases] << "," << sum[num_phases] / num_ranks << "," << max[num_phases]
+      << std::endl;
+
+  json << "{";
+  for (const auto &label : labels) {
+    json << JsonString(label.first) << ":" << JsonString(label.second) << ",";
+  }
+  for (size_t i = 0; i < values.size(); i++) {
+    json << JsonString(values[i].name) << ":" << reduced[i] << ",";
+  }
+  json << "\"phases\":{";
+  for (int i = 0; i < num_phases; i++) {
+    json << (i ? "," : "") << JsonString(phases[i].name) << ":{\"min\":" << min[i]
+         << ",\"avg\":" << sum[i] / num_ranks << ",\"max\":" << max[i]
+         << ",\"rss_max\":" << max_rss[i] << "}";
+  }
+  json << "},\"peak_rss_mb\":{\"min\":" << min[num_phases]
+       << ",\"avg\":" << sum[num_phases] / num_ranks << ",\"max\":" << max[num_phases]
+       << ",\"ranks\":[";
+  for (int r = 0; r < num_ranks; r++) {
+    json << (r ? "," : "") << rank_rss[r];
+  }
+  json << "]},\"cases\":[";
+  for (size_t i = 0; i < cases.size(); i++) {
+    json << (i ? "," : "") << "{\"name\":" << JsonString(cases[i].name)
+         << ",\"iterations\":" << cases[i].iterations << ",\"time\":" << cases[i].time << "}";
+  }
+  json << "]}" << std::endl;
+  return csv.good() && json.good();
+}
+
+void PipelinedCGSolver::Precondition(const Vector &x, Vector &y) const {
+  if (prec) {
+    prec->Mult(x, y);
+  } else {
+    y = x;
+  }
+}
+
+void PipelinedCGSolver::Mult(const Vector &b, Vector &x) const {
+  for (Vector *v : {&r, &u, &w, &m, &n, &p, &q, &s, &z}) {
+    v->SetSize(height);
+    v->UseDevice(true); // run the vector operations on the device (e.g. omp)
+  }
+
+  // r = b - A x, u = B r, w = A u
+  if (iterative_mode) {
+    oper->Mult(x, r);
+    subtract(b, r, r);
+  } else {
+    r = b;
+    x = 0.0;
+  }
+  Precondition(r, u);
+  oper->Mult(u, w);
+
+  double gamma = 0.0, gamma_old = 0.0, alpha = 0.0, tolerance = 0.0;
+  converged = false;
+  final_iter = max_iter;
+  for (int i = 0; i <= max_iter; i++) {
+    // Reduce (r, u) and (w, u) while m = B w and n = A m are computed.
+    double local[2] = {r * u, w * u};
+    double global[2];
+    MPI_Request request;
+    MPI_Iallreduce(local, global, 2, MPI_DOUBLE, MPI_SUM, dot_comm, &request);
+    Precondition(w, m);
+    oper->Mult(m, n);
+    MPI_Wait(&request, MPI_STATUS_IGNORE);
+    gamma = global[0];
+    double delta = global[1];
+
+    if (i == 0) {
+      tolerance = std::max(gamma * rel_tol * rel_tol, abs_tol * abs_tol);
+    }
+    if (print_options.iterations) {
+      mfem::out << "   Iteration : " << std::setw(3) << i << "  (B r, r) = " << gamma << '\n';
+    }
+    if (gamma <= tolerance) {
+      converged = true;
+      final_iter = i;
+      break;
+    }
+    if (i == max_iter) {
+      break;
+    }
+
+    if (i == 0) {
+      alpha = gamma / delta;
+      z = n;
+      q = m;
+      s = w;
+      p = u;
+    } else {
+      double beta = gamma / gamma_old;
+      alpha = gamma / (delta - beta * gamma / alpha);
+      add(n, beta, z, z);
+      add(m, beta, q, q);
+      add(w, beta, s, s);
+      add(u, beta, p, p);
+    }
+    if (!(alpha > 0.0)) {
+      if (print_options.warnings) {
+        mfem::out << "Pipelined CG: breakdown, the operator or the preconditioner is not"
+                     " positive definite.\n";
+      }
+      final_iter = i;
+      break;
+    }
+    x.Add(alpha, p);
+    r.Add(-alpha, s);
+    u.Add(-alpha, q);
+    w.Add(-alpha, z);
+    gamma_old = gamma;
+  }
+  final_norm = sqrt(std::max(gamma, 0.0));
+
+  if (print_options.summary || (!converged && print_options.warnings)) {
+    mfem::out << "Pipelined CG: Number of iterations: " << final_iter << '\n';
+  }
+  if (!converged && print_options.warnings) {
+    mfem::out << "Pipelined CG: No convergence!\n";
+  }
+}
+
+ConductionOperator::ConductionOperator(ParFiniteElementSpace &f, double al, double kap,
+                                       const SolverOptions &solver, const Vector &u)
+    : TimeDependentOperator(f.GetTrueVSize(), 0.0), fespace(f), M(NULL), K(NULL), Mmat(NULL),
+      Kmat(NULL), T(NULL), T_amg(NULL), current_dt(0.0),
+      M_solver(CreateKrylovSolver(f.GetComm(), solver)),
+      T_solver(CreateKrylovSolver(f.GetComm(), solver)), T_prec(T_amg_prec),
+      u_alpha_gf(&f), u_coeff(&u_alpha_gf), alpha(al), kappa(kap),
+      reuse_tol(solver.reuse_tol), amg_stale(true), amg_setups(0), amg_setup_time(0.0),
+      solver_iterations(0), z(height) {
+  M = new ParBilinearForm(&fespace);
+  M->AddDomainIntegrator(new MassIntegrator());
+  M->Assemble(0); // keep sparsity pattern of M and K the same
+  M->Finalize(0);
+  Mmat = M->ParallelAssemble(); // no essential dofs, so no elimination is needed
+
+  // Both solvers take the Krylov method, the tolerances and the print level
+  // of the solver options.
+  M_solver->iterative_mode = false;
+  M_prec.SetType(HypreSmoother::Jacobi);
+  M_solver->SetPreconditioner(M_prec);
+  M_solver->SetOperator(*Mmat);
+
+  // K is created once; SetParameters only changes the values of u_alpha_gf
+  // that its integrator reads through u_coeff.
+  K = new ParBilinearForm(&fespace);
+  K->AddDomainIntegrator(new DiffusionIntegrator(u_coeff));
+
+  ConfigureAMG(T_amg_prec, solver);
+
+  T_solver->iterative_mode = false;
+  T_solver->SetPreconditioner(T_prec);
+
+  SetParameters(u);
+}
+
+void ConductionOperator::Mult(const Vector &u, Vector &du_dt) const {
+  // Compute:
+  //    du_dt = M^{-1}*-Ku
+  // for du_dt, where K is linearized by using u from the previous timestep
+  Kmat->Mult(u, z);
+  z.Neg(); // z = -z
+  M_solver->Mult(z, du_dt);
+  MFEM_VERIFY(M_solver->GetConverged(), "M solver did not converge.");
+}
+
+void ConductionOperator::ImplicitSolve(const double dt, const Vector &u,
+                                       Vector &du_dt) {
+  // Solve the equation:
+  //    du_dt = M^{-1}*[-K(u + dt*du_dt)]
+  // for du_dt, where K is linearized by using u from the previous timestep
+  if (!T || dt != current_dt) {
+    // T = M + dt K is the sum of the parallel matrices, which have the same
+    // row and column partitions.
+    if (T != T_amg) {
+      delete T;
+    }
+    T = Add(1.0, *Mmat, dt, *Kmat);
+    T_solver->SetOperator(*T);
+
+    // The hierarchy is built on the current T and kept alive with it, as
+    // BoomerAMG uses its matrix in every application.
+    if (amg_stale || dt != current_dt) {
+      auto start_setup = std::chrono::steady_clock::now();
+      T_amg_prec.SetOperator(*T);
+      SetupPreconditioner(T_amg_prec, T->Height());
+      auto end_setup = std::chrono::steady_clock::now();
+      amg_setup_time += std::chrono::duration<double>(end_setup - start_setup).count();
+      if (T_amg != T) {
+        delete T_amg;
+      }
+      T_amg = T;
+      u_amg = u_param;
+      amg_stale = false;
+      amg_setups++;
+    }
+    current_dt = dt;
+  }
+  Kmat->Mult(u, z);
+  z.Neg();
+  T_solver->Mult(z, du_dt);
+  solver_iterations += T_solver->GetNumIterations();
+  MFEM_VERIFY(T_solver->GetConverged(), "T solver did not converge.");
+}
+
+void ConductionOperator::SetParameters(const Vector &u) {
+  u_alpha_gf.SetFromTrueDofs(u);
+#ifdef _OPENMP
+#pragma omp parallel for
+#endif
+  for (int i = 0; i < u_alpha_gf.Size(); i++) {
+    u_alpha_gf(i) = kappa + alpha * u_alpha_gf(i);
+  }
+
+  // Reassemble into the existing pattern instead of rebuilding the form. The
+  // pattern is allocated by the first Assemble. M and K have the same
+  // pattern, so that their parallel sum is cheap.
+  if (Kmat) {
+    K->SpMat() = 0.0;
+  }
+  K->Assemble(0); // keep the zero entries, so that the refills find the whole pattern
+  K->Finalize(0);
+  delete Kmat;
+  Kmat = K->ParallelAssemble(); // no essential dofs, so no elimination is needed
+  u_param = u;
+
+  // Relative change of the diffusivity since the last AMG setup:
+  //    |alpha| max|u - u_amg| / max|kappa + alpha u_amg|
+  if (!amg_stale && u_amg.Size() == u.Size()) {
+    double local[2];
+    z = u;
+    z -= u_amg;
+    local[0] = fabs(alpha) * z.Normlinf();
+    z = u_amg;
+    z *= alpha;
+    z += kappa;
+    local[1] = z.Normlinf();
+    double global[2];
+    MPI_Allreduce(local, global, 2, MPI_DOUBLE, MPI_MAX, fespace.GetComm());
+    amg_stale = global[0] > reuse_tol * global[1];
+  }
+
+  if (T != T_amg) {
+    delete T;
+  }
+  T = NULL; // re-compute T on the next ImplicitSolve
+}
+
+ConductionOperator::~ConductionOperator() {
+  delete T_solver;
+  delete M_solver;
+  if (T != T_amg) {
+    delete T;
+  }
+  delete T_amg;
+  delete Kmat;
+  delete Mmat;
+  delete M;
+  delete K;
+}
+
+ResultWriter::ResultWriter(const char *name, ParGridFunction &u, const OutputOptions &options)
+    : solution(u), submesh(NULL), sub_fec(NULL), sub_fespace(NULL), sub_solution(NULL),
+      transfer(NULL), partition_fec(NULL), partition_fespace(NULL), partition(NULL), pd(NULL),
+      collection_path(std::string("ParaView/") + name), cycle(0), write_time(0.0),
+      bytes_written(0.0) {
+  if (options.region == OutputOptions::NONE) {
+    return;
+  }
+
+  ParFiniteElementSpace &fespace = *u.ParFESpace();
+  ParMesh *out_mesh = fespace.GetParMesh();
+  ParGridFunction *out_solution = &solution;
+  if (options.region == OutputOptions::BOUNDARY) {
+    Array<int> bdr_attributes(out_mesh->bdr_attributes);
+    submesh = new ParSubMesh(ParSubMesh::CreateFromBoundary(*out_mesh, bdr_attributes));
+    sub_fec = new H1_FECollection(fespace.FEColl()->GetOrder(), submesh->Dimension());
+    sub_fespace = new ParFiniteElementSpace(submesh, sub_fec);
+    sub_solution = new ParGridFunction(sub_fespace);
+    transfer = new ParTransferMap(solution, *sub_solution);
+    out_mesh = submesh;
+    out_solution = sub_solution;
+  }
+
+  pd = new ParaViewDataCollection(name, out_mesh);
+  pd->SetPrefixPath("ParaView");
+  if (options.solution) {
+    pd->RegisterField("solution", out_solution);
+  }
+  if (options.partition) {
+    partition_fec = new L2_FECollection(0, out_mesh->Dimension());
+    partition_fespace = new ParFiniteElementSpace(out_mesh, partition_fec);
+    partition = new ParGridFunction(partition_fespace);
+    *partition = static_cast<double>(out_mesh->GetMyRank());
+    pd->RegisterField("partition", partition);
+  }
+  pd->SetLevelsOfDetail(options.levels_of_detail);
+  pd->SetDataFormat(options.float32 ? VTKFormat::BINARY32 : VTKFormat::BINARY);
+  if (options.compression > 0) {
+    pd->SetCompressionLevel(options.compression);
+  }
+  pd->SetHighOrderOutput(true);
+}
+
+void ResultWriter::Write() {
+  auto start_write = std::chrono::steady_clock::now();
+  pd->Save();
+  auto end_write = std::chrono::steady_clock::now();
+  write_time += std::chrono::duration<double>(end_write - start_write).count();
+
+  // Each rank writes its piece of the cycle; rank 0 also writes the pvtu and
+  // pvd files that index the pieces.
+  const int rank = Mpi::WorldRank();
+  char cycle_dir[32], piece[32];
+  snprintf(cycle_dir, sizeof(cycle_dir), "/Cycle%06d/", cycle);
+  snprintf(piece, sizeof(piece), "proc%06d.vtu", rank);
+  bytes_written += FileSize(collection_path + cycle_dir + piece);
+  if (rank == 0) {
+    bytes_written += FileSize(collection_path + cycle_dir + "data.pvtu");
+    bytes_written += FileSize(collection_path + "/" + pd->GetCollectionName() + ".pvd");
+  }
+}
+
+void ResultWriter::Save(int cycle, double time) {
+  if (!pd) {
+    return;
+  }
+  Wait();
+  if (transfer) {
+    transfer->Transfer(solution, *sub_solution);
+  }
+  pd->SetCycle(cycle);
+  pd->SetTime(time);
+  this->cycle = cycle;
+  Write();
+}
+
+void ResultWriter::SaveAsync(int cycle, double time) {
+  if (!pd) {
+    return;
+  }
+  Wait();
+  // The transfer communicates shared dofs, so it stays on the calling thread.
+  if (transfer) {
+    transfer->Transfer(solution, *sub_solution);
+  }
+  pd->SetCycle(cycle);
+  pd->SetTime(time);
+  this->cycle = cycle;
+  io_thread = std::thread(&ResultWriter::Write, this);
+}
+
+void ResultWriter::Wait() {
+  if (io_thread.joinable()) {
+    io_thread.join();
+  }
+}
+
+ResultWriter::~ResultWriter() {
+  Wait();
+  delete pd;
+  delete partition;
+  delete partition_fespace;
+  delete partition_fec;
+  delete transfer;
+  delete sub_solution;
+  delete sub_fespace;
+  delete sub_fec;
+  delete submesh;
+}
+
+bool HeatCase::SharesMatrix(const HeatCase &other) const {
+  for (int i = 0; i < dirichlet.Size(); i++) {
+    if (dirichlet[i] != other.dirichlet[i] || robin_h(i) != other.robin_h(i)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// Reads a case file. Each non-empty line that does not start with '#' is one
+// case: its name followed by any number of
+//    source:<attribute>=<f>          volume source on a domain attribute
+//    dirichlet:<attribute>=<T>       imposed temperature
+//    neumann:<attribute>=<q>         imposed flux
+//    robin:<attribute>=<h>,<T_inf>   convective exchange h (T_inf - u)
+// Boundaries without a condition are insulated.
+bool ReadCases(const char *filename, int num_attributes, int num_bdr_attributes,
+               std::vector<HeatCase> &cases) {
+  const bool root = Mpi::WorldRank() == 0;
+  std::ifstream input(filename);
+  if (!input) {
+    if (root) {
+      cerr << "Unable to read the case file " << filename << endl;
+    }
+    return false;
+  }
+
+  std::string line;
+  int line_number = 0;
+  while (std::getline(input, line)) {
+    line_number++;
+    std::istringstream tokens(line);
+    HeatCase c;
+    if (!(tokens >> c.name) || c.name[0] == '#') {
+      continue;
+    }
+    c.source.SetSize(num_attributes);
+    c.source = 0.0;
+    c.dirichlet.SetSize(num_bdr_attributes);
+    c.dirichlet = 0;
+    c.temperature.SetSize(num_bdr_attributes);
+    c.temperature = 0.0;
+    c.flux.SetSize(num_bdr_attributes);
+    c.flux = 0.0;
+    c.robin_h.SetSize(num_bdr_attributes);
+    c.robin_h = 0.0;
+
+    std::string token;
+    while (tokens >> token) {
+      size_t colon = token.find(':');
+      size_t equal = token.find('=');
+      int attribute = 0;
+      double value = 0.0, t_inf = 0.0;
+      bool valid = colon != std::string::npos && equal != std::string::npos && colon < equal;
+      std::string kind = valid ? token.substr(0, colon) : "";
+      if (valid) {
+        std::istringstream number(token.substr(colon + 1, equal - colon - 1));
+        std::istringstream values(token.substr(equal + 1));
+        char comma = 0;
+        valid = static_cast<bool>(number >> attribute) && static_cast<bool>(values >> value);
+        if (kind == "robin") {
+          valid = valid && (values >> comma >> t_inf) && comma == ',';
+        }
+      }
+      const int count = kind == "source" ? num_attributes : num_bdr_attributes;
+      if (!valid || attribute < 1 || attribute > count) {
+        if (root) {
+          cerr << filename << ":" << line_number << ": invalid condition " << token << endl;
+        }
+        return false;
+      }
+
+      const int i = attribute - 1;
+      if (kind == "source") {
+        c.source(i) = value;
+      } else if (kind == "dirichlet") {
+        c.dirichlet[i] = 1;
+        c.temperature(i) = value;
+      } else if (kind == "neumann") {
+        c.flux(i) = value;
+      } else if (kind == "robin") {
+        c.robin_h(i) = value;
+        c.flux(i) = value * t_inf;
+      } else {
+        if (root) {
+          cerr << filename << ":" << line_number << ": unknown condition " << kind << endl;
+        }
+        return false;
+      }
+    }
+
+    // Without a Dirichlet or Robin term, the temperature is only known up to
+    // a constant and the matrix is singular.
+    bool bounded = false;
+    for (int i = 0; i < num_bdr_attributes; i++) {
+      bounded = bounded || c.dirichlet[i] || c.robin_h(i) > 0.0;
+    }
+    if (!bounded) {
+      if (root) {
+        cerr << filename << ":" << line_number << ": case " << c.name
+             << " needs a dirichlet or robin condition" << endl;
+      }
+      return false;
+    }
+    cases.push_back(c);
+  }
+
+  if (cases.empty()) {
+    if (root) {
+      cerr << "No case in " << filename << endl;
+    }
+    return false;
+  }
+  return true;
+}
+
+// Order in which to solve the cases: the cases sharing a matrix are grouped,
+// the groups and the cases within a group keep the order of the file.
+std::vector<int> GroupCasesByMatrix(const std::vector<HeatCase> &cases) {
+  std::vector<int> order;
+  std::vector<bool> done(cases.size(), false);
+  for (size_t i = 0; i < cases.size(); i++) {
+    if (done[i]) {
+      continue;
+    }
+    for (size_t j = i; j < cases.size(); j++) {
+      if (!done[j] && cases[j].SharesMatrix(cases[i])) {
+        order.push_back(j);
+        done[j] = true;
+      }
+    }
+  }
+  return order;
+}
+
+bool ParseOutputFields(const char *fields, OutputOptions &options) {
+  options.solution = false;
+  options.partition = false;
+  std::string list(fields);
+  size_t begin = 0;
+  while (begin <= list.size()) {
+    size_t end = list.find(',', begin);
+    if (end == std::string::npos) {
+      end = list.size();
+    }
+    std::string field = list.substr(begin, end - begin);
+    if (field == "solution") {
+      options.solution = true;
+    } else if (field == "partition") {
+      options.partition = true;
+    } else if (!field.empty()) {
+      return false;
+    }
+    begin = end + 1;
+  }
+  return true;
+}
+
+// Name of the piece of this rank in the mesh cache. The number of ranks is part
+// of the name, since a piece can only be read back by the same partitioning.
+static std::string MeshCacheFilename(const std::string &prefix, int ref_levels) {
+  return MakeParFilename(prefix + "_np" + std::to_string(Mpi::WorldSize()) + "_rp"
+                             + std::to_string(ref_levels) + ".",
+                         Mpi::WorldRank());
+}
+
+// Identity of the serial mesh a cache piece was written from: its path, size
+// and modification time, on the first line of the piece.
+std::string MeshIdentity(const char *mesh_file) {
+  std::ostringstream identity;
+  identity << "# heatsim mesh cache of " << mesh_file;
+  struct stat info;
+  if (stat(mesh_file, &info) == 0) {
+    identity << ", " << info.st_size << " bytes, modified " << info.st_mtime;
+  }
+  return identity.str();
+}
+
+ParMesh *LoadCachedMesh(const std::string &prefix, int ref_levels, const std::string &identity) {
+  std::ifstream input(MeshCacheFilename(prefix, ref_levels));
+  std::string header;
+  std::getline(input, header);
+  // Every rank needs its piece of the same mesh, otherwise all of them fall
+  // back together and the pieces are written again.
+  int local[2] = {input.good() ? 1 : 0, input.good() && header == identity ? 1 : 0};
+  int global[2] = {0, 0};
+  MPI_Allreduce(local, global, 2, MPI_INT, MPI_MIN, MPI_COMM_WORLD);
+  if (global[0] && !global[1] && Mpi::WorldRank() == 0) {
+    cout << "The mesh cache " << prefix << " was written from another mesh, it is rebuilt."
+         << endl;
+  }
+  if (!global[1]) {
+    return NULL;
+  }
+  return new ParMesh(MPI_COMM_WORLD, input);
+}
+
+void SaveCachedMesh(ParMesh &pmesh, const std::string &prefix, int ref_levels,
+                    const std::string &identity) {
+  std::ofstream output(MeshCacheFilename(prefix, ref_levels));
+  output << identity << '\n';
+  output.precision(16);
+  pmesh.ParPrint(output);
+}
+
+// Header of the checkpoint file of a rank, followed by the mesh piece in the
+// MFEM parallel mesh format (the only serialization of a ParMesh, which also
+// covers nonconforming meshes) and the solution as raw doubles.
+struct CheckpointHeader {
+  char magic[8];
+  int32_t ranks, mode, order, ref_levels, step, sequence;
+  double time;
+  uint64_t mesh_bytes, solution_size;
+};
+
+static const char checkpoint_magic[8] = {'H', 'E', 'A', 'T', 'C', 'K', 'P', '1'};
+static volatile sig_atomic_t sigterm_received = 0;
+
+static void HandleSigterm(int) { sigterm_received = 1; }
+
+// Odd and even sequences go to the slots A and B.
+static std::string CheckpointFilename(const std::string &prefix, int sequence) {
+  return MakeParFilename(prefix + (sequence % 2 ? ".A." : ".B."), Mpi::WorldRank());
+}
+
+// Reads the header of a checkpoint piece, and whether it is one of this run.
+static bool ReadCheckpointHeader(std::istream &input, CheckpointHeader &header) {
+  input.read(reinterpret_cast<char *>(&header), sizeof(header));
+  return input.good() && std::memcmp(header.magic, checkpoint_magic, 8) == 0 &&
+         header.ranks == Mpi::WorldSize();
+}
+
+Checkpointer::Checkpointer(const char *p, double i)
+    : prefix(p), interval(i), last_write(std::chrono::steady_clock::now()), terminated(false),
+      sequence(0), count(0), bytes_written(0.0) {
+  if (Enabled()) {
+    std::signal(SIGTERM, HandleSigterm);
+  }
+}
+
+void Checkpointer::ReleaseSigterm() {
+  if (Enabled()) {
+    std::signal(SIGTERM, SIG_DFL);
+  }
+}
+
+bool Checkpointer::Due() {
+  if (!Enabled()) {
+    return false;
+  }
+  double elapsed =
+      std::chrono::duration<double>(std::chrono::steady_clock::now() - last_write).count();
+  int local = sigterm_received ? 2 : (interval > 0.0 && elapsed >= interval ? 1 : 0);
+  int global = 0;
+  MPI_Allreduce(&local, &global, 1, MPI_INT, MPI_MAX, MPI_COMM_WORLD);
+  terminated = global == 2;
+  return global > 0;
+}
+
+void Checkpointer::Write(ParMesh &pmesh, const CheckpointState &state) {
+  std::ostringstream mesh;
+  mesh.precision(16);
+  pmesh.ParPrint(mesh);
+  const std::string mesh_text = mesh.str();
+
+  CheckpointHeader header;
+  std::memcpy(header.magic, checkpoint_magic, sizeof(header.magic));
+  header.ranks = Mpi::WorldSize();
+  header.mode = state.mode;
+  header.order = state.order;
+  header.ref_levels = state.ref_levels;
+  header.step = state.step;
+  header.sequence = ++sequence;
+  header.time = state.time;
+  header.mesh_bytes = mesh_text.size();
+  header.solution_size = state.solution.Size();
+
+  // The slot of the checkpoint before the previous one is replaced, through
+  // a temporary file so that a piece is either complete or absent.
+  const std::string filename = CheckpointFilename(prefix, header.sequence);
+  const std::string tmp_filename = filename + ".tmp";
+  {
+    std::ofstream output(tmp_filename, std::ios::binary);
+    output.write(reinterpret_cast<const char *>(&header), sizeof(header));
+    output.write(mesh_text.data(), mesh_text.size());
+    output.write(reinterpret_cast<const char *>(state.solution.GetData()),
+                 state.solution.Size() * sizeof(double));
+    MFEM_VERIFY(output.good(), "Unable to write the checkpoint " << tmp_filename);
+  }
+  std::rename(tmp_filename.c_str(), filename.c_str());
+  bytes_written += FileSize(filename);
+  count++;
+  last_write = std::chrono::steady_clock::now();
+  MPI_Barrier(MPI_COMM_WORLD);
+}
+
+ParMesh *ReadCheckpoint(const std::string &prefix, CheckpointState &state) {
+  // Sequence of the piece of this rank in each slot, or 0.
+  int sequences[2] = {0, 0};
+  for (int slot = 0; slot < 2; slot++) {
+    std::ifstream input(CheckpointFilename(prefix, slot + 1), std::ios::binary);
+    CheckpointHeader header;
+    if (ReadCheckpointHeader(input, header)) {
+      sequences[slot] = header.sequence;
+    }
+  }
+
+  // A run killed while writing may leave the newest slot with pieces of two
+  // checkpoints. Restart from the newest checkpoint that every rank holds:
+  // it is in the same slot on all ranks, so on rank 0 too.
+  int candidates[2] = {sequences[0], sequences[1]};
+  MPI_Bcast(candidates, 2, MPI_INT, 0, MPI_COMM_WORLD);
+  int local[2], complete[2];
+  for (int slot = 0; slot < 2; slot++) {
+    local[slot] = candidates[slot] > 0 && sequences[slot] == candidates[slot];
+  }
+  MPI_Allreduce(local, complete, 2, MPI_INT, MPI_MIN, MPI_COMM_WORLD);
+  int sequence = 0;
+  for (int slot = 0; slot < 2; slot++) {
+    if (complete[slot] && candidates[slot] > sequence) {
+      sequence = candidates[slot];
+    }
+  }
+  if (sequence == 0) {
+    if (Mpi::WorldRank() == 0) {
+      cerr << "Unable to restart from " << prefix << ": no checkpoint is complete on all the"
+           << " ranks, or it was written by another number of ranks." << endl;
+    }
+    return NULL;
+  }
+
+  const std::string filename = CheckpointFilename(prefix, sequence);
+  std::ifstream input(filename, std::ios::binary);
+  CheckpointHeader header;
+  ReadCheckpointHeader(input, header);
+  std::string mesh_text(header.mesh_bytes, '\0');
+  input.read(&mesh_text[0], header.mesh_bytes);
+  state.mode = header.mode;
+  state.order = header.order;
+  state.ref_levels = header.ref_levels;
+  state.step = header.step;
+  state.sequence = header.sequence;
+  state.time = header.time;
+  state.solution.SetSize(header.solution_size);
+  input.read(reinterpret_cast<char *>(state.solution.GetData()),
+             header.solution_size * sizeof(double));
+  MFEM_VERIFY(input.good(), "Truncated checkpoint " << filename);
+
+  std::istringstream mesh(mesh_text);
+  return new ParMesh(MPI_COMM_WORLD, mesh);
+}
+
+ODESolver *CreateODESolver(int ode_solver_type) {
+  switch (ode_solver_type) {
+  // Implicit L-stable methods
+  case 1:
+    return new BackwardEulerSolver;
+  case 2:
+    return new SDIRK23Solver(2);
+  case 3:
+    return new SDIRK33Solver;
+  // Explicit methods
+  case 11:
+    return new ForwardEulerSolver;
+  case 12:
+    return new RK2Solver(0.5); // midpoint method
+  case 13:
+    return new RK3SSPSolver;
+  case 14:
+    return new RK4Solver;
+  case 15:
+    return new GeneralizedAlphaSolver(0.5);
+  // Implicit A-stable methods (not L-stable)
+  case 22:
+    return new ImplicitMidpointSolver;
+  case 23:
+    return new SDIRK23Solver;
+  case 24:
+    return new SDIRK34Solver;
+  default:
+    return NULL;
+  }
+}
+
+bool ParseKrylov(const char *name, SolverOptions::Krylov &krylov) {
+  if (strcmp(name, "cg") == 0) {
+    krylov = SolverOptions::CG;
+  } else if (strcmp(name, "pipecg") == 0) {
+    krylov = SolverOptions::PIPELINED_CG;
+  } else {
+    return false;
+  }
+  return true;
+}
+
+bool ReadSolverConfig(const char *filename, SolverOptions &options) {
+  const bool root = Mpi::WorldRank() == 0;
+  std::ifstream input(filename);
+  if (!input) {
+    if (root) {
+      cerr << "Unable to read the solver configuration " << filename << endl;
+    }
+    return false;
+  }
+
+  std::string line;
+  int line_number = 0;
+  while (std::getline(input, line)) {
+    line_number++;
+    // Lines are "option value" or "option = value", with the long option names.
+    std::replace(line.begin(), line.end(), '=', ' ');
+    std::istringstream tokens(line);
+    std::string key, value;
+    if (!(tokens >> key) || key[0] == '#') {
+      continue;
+    }
+    tokens >> value;
+    std::istringstream number(value);
+    bool valid;
+    if (key == "krylov") {
+      valid = ParseKrylov(value.c_str(), options.krylov);
+    } else if (key == "rel-tol") {
+      valid = static_cast<bool>(number >> options.rel_tol);
+    } else if (key == "abs-tol") {
+      valid = static_cast<bool>(number >> options.abs_tol);
+    } else if (key == "max-iter") {
+      valid = static_cast<bool>(number >> options.max_iter);
+    } else if (key == "print-level") {
+      valid = static_cast<bool>(number >> options.print_level);
+    } else if (key == "amg-coarsening") {
+      valid = static_cast<bool>(number >> options.amg_coarsening);
+    } else if (key == "amg-interpolation") {
+      valid = static_cast<bool>(number >> options.amg_interpolation);
+    } else if (key == "amg-aggressive") {
+      valid = static_cast<bool>(number >> options.amg_aggressive);
+    } else if (key == "amg-smoother") {
+      valid = static_cast<bool>(number >> options.amg_smoother);
+    } else if (key == "amg-theta") {
+      valid = static_cast<bool>(number >> options.amg_theta);
+    } else if (key == "amg-reuse") {
+      valid = value == "true" || value == "false";
+      options.amg_reuse = value == "true";
+    } else if (key == "reuse-tol") {
+      valid = static_cast<bool>(number >> options.reuse_tol);
+    } else {
+      valid = false;
+    }
+    if (!valid) {
+      if (root) {
+        cerr << filename << ":" << line_number << ": invalid solver option: " << line << endl;
+      }
+      return false;
+    }
+  }
+  return true;
+}
+
+IterativeSolver *CreateKrylovSolver(MPI_Comm comm, const SolverOptions &options) {
+  IterativeSolver *solver;
+  if (options.krylov == SolverOptions::PIPELINED_CG) {
+    solver = new PipelinedCGSolver(comm);
+  } else {
+    solver = new CGSolver(comm);
+  }
+  solver->SetRelTol(options.rel_tol);
+  solver->SetAbsTol(options.abs_tol);
+  solver->SetMaxIter(options.max_iter);
+  IterativeSolver::PrintLevel print_level;
+  print_level.Warnings().Errors();
+  if (options.print_level >= 1) {
+    print_level.Summary();
+  }
+  if (options.print_level >= 2) {
+    print_level.Iterations();
+  }
+  solver->SetPrintLevel(print_level);
+  return solver;
+}
+
+void ConfigureAMG(HypreBoomerAMG &amg, const SolverOptions &options) {
+  amg.SetPrintLevel(0);
+  amg.SetCoarsening(options.amg_coarsening);
+  amg.SetInterpolation(options.amg_interpolation);
+  amg.SetAggressiveCoarsening(options.amg_aggressive);
+  amg.SetRelaxType(options.amg_smoother);
+  amg.SetStrengthThresh(options.amg_theta);
+}
+
+double InitialTemperature(const Vector &x) {
+  if (x.Norml2() < 0.5) {
+    return 2.0;
+  } else {
+    return 1.0;
+  }
+}
+
@@ -0,0 +1,438 @@
+//
+// Scaling sweep driver for heatsim.
+//
+// Description:  Runs heatsim for every combination of a list of rank counts
+//               and refinement levels, each run appending one row to the
+//               benchmark file, then prints the strong and weak scaling
+//               tables of that file. With a list of thread counts, the
+//               hybrid MPI+OpenMP runs also get a thread scaling table of
+//               each phase, and the runs with an error estimate get an
+//               accuracy per DoF table (uniform and adaptive refinement).
+//
+//               heatsweep run -np 1,2,4,8 -rp 1,2,3 -l "srun --ntasks={n}" -- -o 2 -m ./data/part.msh
+//               heatsweep run -np 2,4,8 -t 1,2,4 -l "srun --ntasks={n} --cpus-per-task={t}" -- -o 2
+//               heatsweep table -b Heatsim_benchmark
+//
+//               Strong scaling compares the runs of the same problem (mode,
+//               mesh, order, assembly, solver and refinement) on more ranks. Weak
+//               scaling compares the runs with about the same number of
+//               degrees of freedom per rank.
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <sys/wait.h>
+
+struct SweepOptions {
+  std::vector<int> ranks = {1, 2, 4, 8, 16, 32, 64};
+  std::vector<int> refine_levels = {1, 2, 3, 4};
+  std::vector<int> threads; // OpenMP threads per rank, heatsim's default if empty
+  std::string launcher = "mpirun -np {n}";
+  std::string executable = "./build/heatsim";
+  std::string name = "Heatsim";
+  std::string benchmark = "Heatsim_benchmark";
+  std::string log_dir;
+  std::string heatsim_args;
+  bool dry_run = false;
+};
+
+// One row of the benchmark file, indexed by column name.
+typedef std::map<std::string, std::string> Run;
+
+static void PrintUsage() {
+  std::cout
+      << "Usage: heatsweep run [options] [-- heatsim options]\n"
+      << "       heatsweep table [-b <benchmark>]\n"
+      << "Options:\n"
+      << "   -np <list>   Comma-separated rank counts (default 1,2,4,8,16,32,64).\n"
+      << "   -rp <list>   Comma-separated parallel refinement levels (default 1,2,3,4).\n"
+      << "   -t <list>    Comma-separated OpenMP threads per rank (default: not set).\n"
+      << "   -l <string>  Launcher command, {n} is replaced by the rank count and {t}\n"
+      << "                by the threads per rank (default \"mpirun -np {n}\").\n"
+      << "   -x <path>    heatsim executable (default ./build/heatsim).\n"
+      << "   -n <string>  Prefix of the output collections (default Heatsim).\n"
+      << "   -b <string>  Benchmark file prefix (default Heatsim_benchmark).\n"
+      << "   -log <dir>   Redirect the output of each run to <dir>/<name>_<n>_<rp>[_t<t>].out.\n"
+      << "   -dry         Print the commands without running them.\n";
+}
+
+static bool ParseList(const std::string &text, std::vector<int> &list) {
+  list.clear();
+  std::istringstream in(text);
+  std::string item;
+  while (std::getline(in, item, ',')) {
+    char *end;
+    long value = std::strtol(item.c_str(), &end, 10);
+    if (item.empty() || *end != '\0' || value < 0) {
+      return false;
+    }
+    list.push_back(static_cast<int>(value));
+  }
+  return !list.empty();
+}
+
+// Splits a CSV line, with quoted fields whose quotes are doubled.
+static std::vector<std::string> SplitCsv(const std::string &line) {
+  std::vector<std::string> fields(1);
+  bool quoted = false;
+  for (size_t i = 0; i < line.size(); i++) {
+    char c = line[i];
+    if (quoted) {
+      if (c == '"' && i + 1 < line.size() && line[i + 1] == '"') {
+        fields.back() += '"';
+        i++;
+      } else if (c == '"') {
+        quoted = false;
+      } else {
+        fields.back() += c;
+      }
+    } else if (c == '"') {
+      quoted = true;
+    } else if (c == ',') {
+      fields.push_back("");
+    } else {
+      fields.back() += c;
+    }
+  }
+  return fields;
+}
+
+static bool ReadBenchmark(const std::string &path, std::vector<Run> &runs) {
+  std::ifstream in(path);
+  if (!in) {
+    return false;
+  }
+  std::string line;
+  std::vector<std::string> header;
+  while (std::getline(in, line)) {
+    if (line.empty()) {
+      continue;
+    }
+    std::vector<std::string> fields = SplitCsv(line);
+    // A new header starts whenever the columns of the benchmark change.
+    if (fields[0] == "name") {
+      header = fields;
+      continue;
+    }
+    if (header.empty() || fields.size() != header.size()) {
+      continue;
+    }
+    Run run;
+    for (size_t i = 0; i < header.size(); i++) {
+      run[header[i]] = fields[i];
+    }
+    // A run stopped by SIGTERM after a checkpoint only did part of the work.
+    if (run.count("status") && run["status"] == "interrupted") {
+      continue;
+    }
+    runs.push_back(run);
+  }
+  return true;
+}
+
+static double Number(const Run &run, const std::string &column) {
+  auto it = run.find(column);
+  return it == run.end() ? 0.0 : std::atof(it->second.c_str());
+}
+
+static std::string Text(const Run &run, const std::string &column) {
+  auto it = run.find(column);
+  return it == run.end() ? "" : it->second;
+}
+
+static std::string ProblemKey(const Run &run) {
+  std::string key = Text(run, "mode") + " " + Text(run, "mesh") + " order " +
+                    Text(run, "order") + " " + Text(run, "assembly");
+  if (run.count("refinement")) {
+    key += " " + Text(run, "refinement");
+  }
+  // Runs recorded before the solver options have no solver columns.
+  if (run.count("krylov")) {
+    key += " " + Text(run, "krylov") + " amg " + Text(run, "amg") + " rtol " +
+           Text(run, "rel_tol");
+  }
+  return key;
+}
+
+static std::string ThreadsKey(const Run &run) {
+  return run.count("threads") ? " threads " + Text(run, "threads") : "";
+}
+
+// Keeps the fastest run for each value of the column, sorted by that value.
+static std::vector<Run> Fastest(const std::vector<Run> &runs, const std::string &column) {
+  std::map<int, Run> best;
+  for (const Run &run : runs) {
+    int value = static_cast<int>(Number(run, column));
+    auto it = best.find(value);
+    if (it == best.end() || Number(run, "total_max") < Number(it->second, "total_max")) {
+      best[value] = run;
+    }
+  }
+  std::vector<Run> sorted;
+  for (const auto &entry : best) {
+    sorted.push_back(entry.second);
+  }
+  return sorted;
+}
+
+static void PrintHeader() {
+  std::printf("%6s %12s %10s %10s %10s %10s %8s %8s %12s %9s\n", "ranks", "dofs", "total",
+              "amg_setup", "solve", "cg_iter", "speedup", "eff", "DoF/s", "imbalance");
+}
+
+static void PrintRow(const Run &run, const Run &base, bool weak) {
+  double ranks = Number(run, "ranks");
+  double total = Number(run, "total_max");
+  double base_total = Number(base, "total_max");
+  double speedup = total > 0.0 ? base_total / total : 0.0;
+  double efficiency = weak ? speedup : speedup * Number(base, "ranks") / ranks;
+  double solve_avg = Number(run, "solve_avg");
+  std::printf("%6.0f %12.0f %10.3f %10.3f %10.3f %10.0f %8.2f %8.2f %12.4g %9.2f\n", ranks,
+              Number(run, "dofs"), total, Number(run, "amg_setup_max"),
+              Number(run, "solve_max"), Number(run, "cg_iterations"), speedup,
+              efficiency, total > 0.0 ? Number(run, "dofs") / total : 0.0,
+              solve_avg > 0.0 ? Number(run, "solve_max") / solve_avg : 1.0);
+}
+
+static int Table(const std::string &benchmark) {
+  std::vector<Run> runs;
+  if (!ReadBenchmark(benchmark + ".csv", runs)) {
+    std::cerr << "Unable to read " << benchmark << ".csv" << std::endl;
+    return 1;
+  }
+
+  // 1. Strong scaling: same problem and refinement on more ranks.
+  std::map<std::string, std::vector<Run>> strong;
+  for (const Run &run : runs) {
+    strong[ProblemKey(run) + " rp " + Text(run, "refine_levels") + ThreadsKey(run)]
+        .push_back(run);
+  }
+  std::cout << "Strong scaling (times in s, max over ranks)" << std::endl;
+  for (const auto &group : strong) {
+    std::vector<Run> series = Fastest(group.second, "ranks");
+    std::cout << std::endl << group.first << std::endl;
+    PrintHeader();
+    for (const Run &run : series) {
+      PrintRow(run, series.front(), false);
+    }
+  }
+
+  // 2. Weak scaling: runs of the same problem bucketed by DoFs per rank (a
+  //    refinement multiplies the DoFs by about 8 in 3D, so ranks 1, 8 and 64
+  //    at three successive levels fall in the same bucket).
+  std::map<std::string, std::vector<Run>> weak;
+  for (const Run &run : runs) {
+    double per_rank = Number(run, "dofs") / std::max(1.0, Number(run, "ranks"));
+    if (per_rank <= 0.0) {
+      continue;
+    }
+    long bucket = std::lround(std::log2(per_rank));
+    weak[ProblemKey(run) + ThreadsKey(run) + " ~2^" + std::to_string(bucket) + " DoFs/rank"]
+        .push_back(run);
+  }
+  std::cout << std::endl << "Weak scaling (efficiency = t(fewest ranks) / t)" << std::endl;
+  for (const auto &group : weak) {
+    std::vector<Run> series = Fastest(group.second, "ranks");
+    if (series.size() < 2) {
+      continue;
+    }
+    std::cout << std::endl << group.first << std::endl;
+    PrintHeader();
+    for (const Run &run : series) {
+      PrintRow(run, series.front(), true);
+    }
+  }
+
+  // 3. Thread scaling: same problem on the same ranks with more threads per
+  //    rank, phase by phase (speedup relative to the fewest threads).
+  std::map<std::string, std::vector<Run>> hybrid;
+  for (const Run &run : runs) {
+    if (run.count("threads")) {
+      hybrid[ProblemKey(run) + " rp " + Text(run, "refine_levels") + " ranks " +
+             Text(run, "ranks")]
+          .push_back(run);
+    }
+  }
+  bool first = true;
+  const char *phases[] = {"assemble", "amg_setup", "solve", "total"};
+  for (const auto &group : hybrid) {
+    std::vector<Run> series = Fastest(group.second, "threads");
+    if (series.size() < 2) {
+      continue;
+    }
+    if (first) {
+      std::cout << std::endl << "Thread scaling (time in s and speedup of each phase)"
+                << std::endl;
+      first = false;
+    }
+    std::cout << std::endl << group.first << std::endl;
+    std::printf("%7s", "threads");
+    for (const char *phase : phases) {
+      std::printf(" %10s %7s", phase, "speedup");
+    }
+    std::printf(" %12s\n", "peak_rss_max");
+    for (const Run &run : series) {
+      std::printf("%7.0f", Number(run, "threads"));
+      for (const char *phase : phases) {
+        std::string column = std::string(phase) + "_max";
+        double time = Number(run, column);
+        std::printf(" %10.3f %7.2f", time,
+                    time > 0.0 ? Number(series.front(), column) / time : 0.0);
+      }
+      std::printf(" %12.1f\n", Number(run, "peak_rss_max"));
+    }
+  }
+
+  // 4. Accuracy per DoF: estimated error of each discretization of a problem,
+  //    by number of DoFs. The error constant (error * dofs^(order/dim)) is
+  //    lower when the same DoFs give a smaller error.
+  std::map<std::string, std::vector<Run>> accuracy;
+  for (const Run &run : runs) {
+    if (Number(run, "estimated_error") > 0.0) {
+      accuracy[Text(run, "mode") + " " + Text(run, "mesh") + " order " + Text(run, "order")]
+          .push_back(run);
+    }
+  }
+  if (!accuracy.empty()) {
+    std::cout << std::endl << "Accuracy per DoF" << std::endl;
+  }
+  for (auto &group : accuracy) {
+    std::vector<Run> &series = group.second;
+    std::stable_sort(series.begin(), series.end(), [](const Run &a, const Run &b) {
+      return Number(a, "dofs") < Number(b, "dofs");
+    });
+    std::cout << std::endl << group.first << std::endl;
+    std::printf("%10s %3s %6s %6s %12s %12s %12s %14s %12s\n", "refinement", "rp", "cycles",
+                "ranks", "elements", "dofs", "error", "error_constant", "DoF/s");
+    for (const Run &run : series) {
+      double total = Number(run, "total_max");
+      std::printf("%10s %3.0f %6.0f %6.0f %12.0f %12.0f %12.4g %14.4g %12.4g\n",
+                  Text(run, "refinement").c_str(), Number(run, "refine_levels"),
+                  Number(run, "amr_cycles"), Number(run, "ranks"), Number(run, "elements"),
+                  Number(run, "dofs"), Number(run, "estimated_error"),
+                  Number(run, "error_constant"),
+                  total > 0.0 ? Number(run, "dofs") / total : 0.0);
+    }
+  }
+  return 0;
+}
+
+// Replaces every occurrence of the placeholder in the text.
+static std::string Substitute(std::string text, const std::string &placeholder, int value) {
+  for (size_t pos = text.find(placeholder); pos != std::string::npos;
+       pos = text.find(placeholder)) {
+    text.replace(pos, placeholder.size(), std::to_string(value));
+  }
+  return text;
+}
+
+static int RunSweep(const SweepOptions &options) {
+  // Without a thread list, --threads is not passed (0 stands for unset).
+  std::vector<int> threads = options.threads.empty() ? std::vector<int>{0} : options.threads;
+  int failures = 0;
+  for (int n : options.ranks) {
+    for (int rp : options.refine_levels) {
+      for (int t : threads) {
+        std::string launcher = Substitute(Substitute(options.launcher, "{n}", n), "{t}",
+                                          std::max(t, 1));
+        std::string name = options.name + "_" + std::to_string(n) + "_" + std::to_string(rp);
+        std::string command = launcher + " " + options.executable + " -rp " +
+                              std::to_string(rp) + " -b " + options.benchmark;
+        if (t > 0) {
+          name += "_t" + std::to_string(t);
+          command += " -t " + std::to_string(t);
+        }
+        command += " -n " + name + options.heatsim_args;
+        if (!options.log_dir.empty()) {
+          // The name may hold the directory of the collections.
+          command += " > " + options.log_dir + "/" + name.substr(name.find_last_of('/') + 1) +
+                     ".out 2>&1";
+        }
+        std::cout << command << std::endl;
+        if (options.dry_run) {
+          continue;
+        }
+        // A failed run (out of memory or time) is reported and skipped, the
+        // other configurations are still measured.
+        int status = std::system(command.c_str());
+        if (status != 0) {
+          // heatsim exits with 2 when SIGTERM stopped it after a checkpoint.
+          if (WIFEXITED(status) && WEXITSTATUS(status) == 2) {
+            std::cerr << "Run " << name << " was interrupted after a checkpoint." << std::endl;
+          } else {
+            std::cerr << "Run " << name << " failed." << std::endl;
+          }
+          failures++;
+        }
+      }
+    }
+  }
+  if (failures > 0) {
+    std::cerr << failures << " run(s) failed." << std::endl;
+  }
+  return failures > 0 ? 1 : 0;
+}
+
+int main(int argc, char *argv[]) {
+  if (argc < 2 || (std::string(argv[1]) != "run" && std::string(argv[1]) != "table")) {
+    PrintUsage();
+    return 1;
+  }
+  const std::string command = argv[1];
+  SweepOptions options;
+  for (int i = 2; i < argc; i++) {
+    std::string arg = argv[i];
+    bool has_value = i + 1 < argc;
+    if (arg == "--") {
+      for (i++; i < argc; i++) {
+        options.heatsim_args += std::string(" ") + argv[i];
+      }
+    } else if (arg == "-np" && has_value) {
+      if (!ParseList(argv[++i], options.ranks)) {
+        std::cerr << "Invalid rank list " << argv[i] << std::endl;
+        return 1;
+      }
+    } else if (arg == "-rp" && has_value) {
+      if (!ParseList(argv[++i], options.refine_levels)) {
+        std::cerr << "Invalid refinement list " << argv[i] << std::endl;
+        return 1;
+      }
+    } else if (arg == "-t" && has_value) {
+      if (!ParseList(argv[++i], options.threads)) {
+        std::cerr << "Invalid thread list " << argv[i] << std::endl;
+        return 1;
+      }
+    } else if (arg == "-l" && has_value) {
+      options.launcher = argv[++i];
+    } else if (arg == "-x" && has_value) {
+      options.executable = argv[++i];
+    } else if (arg == "-n" && has_value) {
+      options.name = argv[++i];
+    } else if (arg == "-b" && has_value) {
+      options.benchmark = argv[++i];
+    } else if (arg == "-log" && has_value) {
+      options.log_dir = argv[++i];
+    } else if (arg == "-dry") {
+      options.dry_run = true;
+    } else {
+      PrintUsage();
+      return 1;
+    }
+  }
+
+  if (command == "table") {
+    return Table(options.benchmark);
+  }
+  int status = RunSweep(options);
+  if (!options.dry_run) {
+    Table(options.benchmark);
+  }
+  return status;
+}